@@ -0,0 +1,283 @@
+#include "shell.h"
+#include <math.h>
+#include <spawn.h>
+
+/*
+ * Benchmarking of commands:
+ *
+ *   bench [-n runs] [-w warmup] [-j] command [args...] [-- command ...]
+ *
+ * Each command is run `warmup` times without being measured and then `runs`
+ * times while wall clock, user and system time of every run are recorded.
+ * Mean, standard deviation, minimum, median and 99th percentile are reported
+ * for each command, followed by a comparison of mean wall clock times if more
+ * than one command was given. With `-j` the report is printed as JSON.
+ *
+ * The command line is parsed only once. Executable is looked up in PATH
+ * before measurement starts and then spawned with posix_spawn, which is far
+ * cheaper than fork for a large process like the shell. Standard output of
+ * the command is discarded.
+ */
+
+#define out(...) dprintf(STDOUT_FILENO, __VA_ARGS__)
+
+typedef struct {
+  double mean, stddev, min, median, p99;
+} stats_t;
+
+typedef struct {
+  char **argv;  /* command to measure */
+  char *path;   /* its executable, NULL if it has to be run via fork */
+  char *name;   /* textual representation of command */
+  double *wall; /* wall clock time of each run */
+  double *user; /* user time of each run */
+  double *sys;  /* system time of each run */
+  int failed;   /* number of runs that did not exit with 0 */
+} bench_t;
+
+/* Find executable in PATH just like external_command does. */
+static char *lookup(const char *name) {
+  const char *path = getenv("PATH");
+
+  if (index(name, '/'))
+    return access(name, X_OK) ? NULL : strdup(name);
+
+  while (path && *path) {
+    size_t len = strcspn(path, ":");
+    char *abs_path = strndup(path, len);
+    strapp(&abs_path, "/");
+    strapp(&abs_path, name);
+    if (!access(abs_path, X_OK))
+      return abs_path;
+    free(abs_path);
+    path += len;
+    if (*path)
+      path++;
+  }
+
+  return NULL;
+}
+
+/* Run the command once. Returns exit status in wait(2) format or -1 if it
+ * could not be waited for, e.g. because the shell got interrupted. */
+static int runonce(bench_t *b, int devnull, sigset_t *mask, double *wallp,
+                   double *userp, double *sysp) {
+  struct timespec start, end;
+  struct rusage ru;
+  int status;
+  pid_t pid;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (b->path) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t sigdef;
+
+    /* Shell ignores job control signals, but the command should not. */
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGTSTP);
+    sigaddset(&sigdef, SIGTTIN);
+    sigaddset(&sigdef, SIGTTOU);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, mask);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                                      POSIX_SPAWN_SETSIGDEF);
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, devnull, STDOUT_FILENO);
+
+    errno = posix_spawn(&pid, b->path, &fa, &attr, b->argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+    if (errno) {
+      msg("bench: %s: %s\n", b->path, strerror(errno));
+      return -1;
+    }
+  } else if ((pid = fork()) == 0) {
+    /* Drop the shell's handlers before they can see a signal. */
+    Signal(SIGINT, SIG_DFL);
+    Signal(SIGTSTP, SIG_DFL);
+    Signal(SIGTTIN, SIG_DFL);
+    Signal(SIGTTOU, SIG_DFL);
+    Signal(SIGCHLD, SIG_DFL);
+    Signal(SIGQUIT, SIG_DFL);
+    Sigprocmask(SIG_SETMASK, mask, NULL);
+    Dup2(devnull, STDOUT_FILENO);
+    external_command(b->argv);
+  } else if (pid < 0) {
+    msg("bench: fork: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (wait4(pid, &status, 0, &ru) < 0) {
+    /* Interrupted by SIGINT, which the command got as well. */
+    kill(pid, SIGKILL);
+    (void)wait4(pid, &status, 0, NULL);
+    return -1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *wallp = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  *userp = seconds(ru.ru_utime);
+  *sysp = seconds(ru.ru_stime);
+  return status;
+}
+
+static int cmpdouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static stats_t mkstats(double *sample, int n) {
+  stats_t st = {0};
+  double *sorted = malloc(sizeof(double) * n);
+
+  memcpy(sorted, sample, sizeof(double) * n);
+  qsort(sorted, n, sizeof(double), cmpdouble);
+
+  for (int i = 0; i < n; i++)
+    st.mean += sorted[i];
+  st.mean /= n;
+  for (int i = 0; i < n; i++)
+    st.stddev += (sorted[i] - st.mean) * (sorted[i] - st.mean);
+  st.stddev = n > 1 ? sqrt(st.stddev / (n - 1)) : 0.0;
+  st.min = sorted[0];
+  st.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  /* Nearest-rank percentile. */
+  st.p99 = sorted[(int)ceil(0.99 * n) - 1];
+
+  free(sorted);
+  return st;
+}
+
+static void report(const char *what, stats_t st) {
+  out("  %-4s  mean %.4fs  stddev %.4fs  min %.4fs  median %.4fs  p99 %.4fs\n",
+      what, st.mean, st.stddev, st.min, st.median, st.p99);
+}
+
+static void jsonstats(const char *what, stats_t st, bool last) {
+  out("      \"%s\": {\"mean\": %.6f, \"stddev\": %.6f, \"min\": %.6f, "
+      "\"median\": %.6f, \"p99\": %.6f}%s\n",
+      what, st.mean, st.stddev, st.min, st.median, st.p99, last ? "" : ",");
+}
+
+int do_bench(char **argv) {
+  int runs = 10, warmup = 0, nbench = 0, status = 0;
+  bool json = false;
+  bench_t *bench = NULL;
+
+  for (; *argv && **argv == '-'; argv++) {
+    if (!strcmp(*argv, "-j"))
+      json = true;
+    else if (!strcmp(*argv, "-n") && argv[1])
+      runs = atoi(*++argv);
+    else if (!strcmp(*argv, "-w") && argv[1])
+      warmup = atoi(*++argv);
+    else if (!strcmp(*argv, "--"))
+      continue;
+    else
+      break;
+  }
+
+  if (!*argv || **argv == '-' || runs < 1 || warmup < 0) {
+    msg("usage: bench [-n runs] [-w warmup] [-j] command ... [-- command ...]"
+        "\n");
+    return 2;
+  }
+
+  /* Commands are separated with "--". */
+  while (*argv) {
+    bench = realloc(bench, sizeof(bench_t) * (nbench + 1));
+    bench_t *b = &bench[nbench++];
+    memset(b, 0, sizeof(bench_t));
+    b->argv = argv;
+    for (; *argv && strcmp(*argv, "--"); argv++) {
+      if (b->name)
+        strapp(&b->name, " ");
+      strapp(&b->name, *argv);
+    }
+    if (*argv)
+      *argv++ = NULL;
+    b->path = lookup(b->argv[0]);
+    b->wall = calloc(runs, sizeof(double));
+    b->user = calloc(runs, sizeof(double));
+    b->sys = calloc(runs, sizeof(double));
+  }
+
+  int devnull = Open("/dev/null", O_WRONLY | O_CLOEXEC, 0);
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  for (int i = 0; i < nbench && !status; i++) {
+    bench_t *b = &bench[i];
+    double wall, user, sys;
+    for (int r = -warmup; r < runs; r++) {
+      int wstatus = runonce(b, devnull, &mask, &wall, &user, &sys);
+      if (wstatus < 0 || WIFSIGNALED(wstatus)) {
+        msg("bench: '%s' interrupted\n", b->name);
+        status = 130;
+        break;
+      }
+      if (r < 0)
+        continue;
+      if (wstatus)
+        b->failed++;
+      b->wall[r] = wall;
+      b->user[r] = user;
+      b->sys[r] = sys;
+    }
+  }
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  Close(devnull);
+
+  if (status == 0 && json) {
+    out("{\n  \"results\": [\n");
+    for (int i = 0; i < nbench; i++) {
+      bench_t *b = &bench[i];
+      char name[MAXLINE];
+      out("    {\n      \"command\": %s,\n      \"runs\": %d,\n"
+          "      \"failed\": %d,\n",
+          jsonstr(name, sizeof(name), b->name), runs, b->failed);
+      jsonstats("wall", mkstats(b->wall, runs), false);
+      jsonstats("user", mkstats(b->user, runs), false);
+      jsonstats("sys", mkstats(b->sys, runs), true);
+      out("    }%s\n", i < nbench - 1 ? "," : "");
+    }
+    out("  ]\n}\n");
+  } else if (status == 0) {
+    int fastest = 0;
+    for (int i = 0; i < nbench; i++) {
+      bench_t *b = &bench[i];
+      stats_t wall = mkstats(b->wall, runs);
+      out("'%s': %d runs", b->name, runs);
+      if (b->failed)
+        out(", %d failed", b->failed);
+      out("\n");
+      report("wall", wall);
+      report("user", mkstats(b->user, runs));
+      report("sys", mkstats(b->sys, runs));
+      if (wall.mean < mkstats(bench[fastest].wall, runs).mean)
+        fastest = i;
+    }
+    double best = mkstats(bench[fastest].wall, runs).mean;
+    for (int i = 0; i < nbench && nbench > 1; i++) {
+      if (i == fastest)
+        continue;
+      out("'%s' ran %.2f times faster than '%s'\n", bench[fastest].name,
+          mkstats(bench[i].wall, runs).mean / best, bench[i].name);
+    }
+  }
+
+  for (int i = 0; i < nbench; i++) {
+    free(bench[i].path);
+    free(bench[i].name);
+    free(bench[i].wall);
+    free(bench[i].user);
+    free(bench[i].sys);
+  }
+  free(bench);
+
+  return status;
+}
@@ -0,0 +1,22 @@
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+/* Helpers shared by standalone benchmarks. */
+
+#include <time.h>
+
+/* Number of items (lines, bytes, entries) a method went through and checksum
+ * of their contents, which must agree between methods being compared. */
+typedef struct {
+  unsigned long count;
+  unsigned long sum;
+} result_t;
+
+/* Seconds on monotonic clock. */
+static inline double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif /* !_BENCHMARK_H_ */
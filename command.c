@@ -31,9 +31,20 @@ static int do_chdir(char **argv) {
 
 /*
  * Displays all stopped or running jobs.
+ * 'jobs -l' lists processes of each job and resources used by those finished
+ * 'jobs --timeline' displays state transitions of recent and present jobs
+ * 'jobs --timeline file' writes them to a file as Chrome trace events
  */
 static int do_jobs(char **argv) {
-  watchjobs(ALL);
+  if (argv[0] && !strcmp(argv[0], "--timeline")) {
+    sigset_t mask;
+    Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+    int status = timeline(argv[1]);
+    Sigprocmask(SIG_SETMASK, &mask, NULL);
+    return status;
+  }
+  bool verbose = argv[0] && !strcmp(argv[0], "-l");
+  watchjobs(ALL, verbose);
   return 0;
 }
 
@@ -91,9 +102,48 @@ static int do_kill(char **argv) {
   return 0;
 }
 
+/*
+ * Wait for background jobs to finish.
+ * 'wait' - wait for all running and queued jobs
+ * 'wait %n pid ...' - wait for listed jobs and processes
+ * 'wait -n ...' - return as soon as any of them finishes
+ * 'wait -t secs ...' - give up after given number of seconds
+ */
+static int do_wait(char **argv) {
+  bool any = false;
+  double timeout = -1.0;
+
+  for (; argv[0] && argv[0][0] == '-'; argv++) {
+    if (!strcmp(argv[0], "-n")) {
+      any = true;
+    } else if (!strcmp(argv[0], "-t") && argv[1]) {
+      timeout = atof(*++argv);
+    } else {
+      msg("usage: wait [-n] [-t secs] [%%job | pid ...]\n");
+      return 2;
+    }
+  }
+
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+  int status = waitjobs(argv, any, timeout);
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  return status;
+}
+
 static command_t builtins[] = {
-  {"quit", do_quit}, {"cd", do_chdir},  {"jobs", do_jobs}, {"fg", do_fg},
-  {"bg", do_bg},     {"kill", do_kill}, {NULL, NULL},
+  {"quit", do_quit},       {"cd", do_chdir},          {"jobs", do_jobs},
+  {"fg", do_fg},           {"bg", do_bg},             {"kill", do_kill},
+  {"wait", do_wait},       {"sched", do_sched},       {"bench", do_bench},
+  {"jobtop", do_jobtop},   {"shstat", do_shstat},     {"metrics", do_metrics},
+  {NULL, NULL},
+};
+
+/* Builtins that run in a subprocess just like external commands do,
+ * so they can be put into background or into a pipeline. */
+static command_t forked_builtins[] = {
+  {"parallel", do_parallel},
+  {NULL, NULL},
 };
 
 int builtin_command(char **argv) {
@@ -110,6 +160,12 @@ int builtin_command(char **argv) {
 noreturn void external_command(char **argv) {
   const char *path = getenv("PATH");
 
+  for (command_t *cmd = forked_builtins; cmd->name; cmd++) {
+    if (strcmp(argv[0], cmd->name))
+      continue;
+    exit(cmd->func(&argv[1]));
+  }
+
   if (!index(argv[0], '/') && path) {
     /* TODO: For all paths in PATH construct an absolute path and execve it. */
 #ifdef STUDENT
@@ -128,6 +184,7 @@ noreturn void external_command(char **argv) {
     (void)execve(argv[0], argv, environ);
   }
 
+  STAT_INC(execfail);
   msg("%s: %s\n", argv[0], strerror(errno));
   exit(EXIT_FAILURE);
 }
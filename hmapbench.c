@@ -0,0 +1,275 @@
+#include "csapp.h"
+#include "hashmap.h"
+#include "tree.h"
+#include "benchmark.h"
+
+/*
+ * Benchmark of hash map from hashmap.h against red-black tree from tree.h:
+ *
+ *   hmapbench [-n keys] [-r repeats]
+ *
+ * Keys resemble those the shell deals with: names of commands or variables
+ * of 2 to 16 characters, and process identifiers. For each kind of key and
+ * each data structure `keys` elements are inserted, looked up, looked up
+ * with keys that are absent and finally removed. Average time of every
+ * operation is printed together with number of elements found, which must
+ * be the same for both data structures. The hash map is also run on a fixed
+ * pool of slots.
+ */
+
+typedef struct strelm {
+  const char *key;
+  int value;
+} strelm_t;
+
+typedef struct pidelm {
+  pid_t key;
+  int value;
+} pidelm_t;
+
+static uint32_t strhash(const strelm_t *e) {
+  return hmap_strhash(e->key);
+}
+
+static bool streq(const strelm_t *a, const strelm_t *b) {
+  return strcmp(a->key, b->key) == 0;
+}
+
+static uint32_t pidhash(const pidelm_t *e) {
+  return jenkins_hash(&e->key, sizeof(e->key), HASHINIT);
+}
+
+static bool pideq(const pidelm_t *a, const pidelm_t *b) {
+  return a->key == b->key;
+}
+
+HMAP_HEAD(strmap, strelm);
+HMAP_GENERATE_STATIC(strmap, strelm, strhash, streq);
+HMAP_HEAD(pidmap, pidelm);
+HMAP_GENERATE_STATIC(pidmap, pidelm, pidhash, pideq);
+
+typedef struct strnode {
+  RB_ENTRY(strnode) link;
+  strelm_t elm;
+} strnode_t;
+
+typedef struct pidnode {
+  RB_ENTRY(pidnode) link;
+  pidelm_t elm;
+} pidnode_t;
+
+static int strcmp_node(strnode_t *a, strnode_t *b) {
+  return strcmp(a->elm.key, b->elm.key);
+}
+
+static int pidcmp_node(pidnode_t *a, pidnode_t *b) {
+  return (a->elm.key > b->elm.key) - (a->elm.key < b->elm.key);
+}
+
+RB_HEAD(strtree, strnode);
+RB_GENERATE_STATIC(strtree, strnode, link, strcmp_node);
+RB_HEAD(pidtree, pidnode);
+RB_GENERATE_STATIC(pidtree, pidnode, link, pidcmp_node);
+
+enum { INSERT, FIND, MISS, REMOVE, NOPS };
+static const char *opname[NOPS] = {"insert", "find", "miss", "remove"};
+
+typedef struct {
+  double time[NOPS];      /* total seconds spent in each operation */
+  unsigned long hits[NOPS]; /* successful operations */
+} optimes_t;
+
+/* Measure one operation applied to every key. */
+#define MEASURE(res, op, i, n, body)                                           \
+  do {                                                                         \
+    double _start = now();                                                     \
+    for (int i = 0; i < (n); i++)                                              \
+      if (body)                                                                \
+        (res)->hits[op]++;                                                     \
+    (res)->time[op] += now() - _start;                                         \
+  } while (0)
+
+static void bench_strmap(optimes_t *res, char **keys, char **absent, int n,
+                         bool fixed) {
+  struct strmap map = HMAP_INITIALIZER(&map);
+  strelm_t *slots = NULL;
+  uint32_t *meta = NULL;
+
+  if (fixed) {
+    size_t size = HMAP_MINSIZE;
+    while (size * 7 < (size_t)n * 8)
+      size *= 2;
+    slots = Malloc(size * sizeof(strelm_t));
+    meta = Malloc(size * sizeof(uint32_t));
+    HMAP_INIT_FIXED(&map, slots, meta, size);
+  }
+
+  MEASURE(res, INSERT, i, n,
+          !HMAP_INSERT(strmap, &map, &((strelm_t){keys[i], i})));
+  MEASURE(res, FIND, i, n, HMAP_FIND(strmap, &map, &((strelm_t){keys[i]})));
+  MEASURE(res, MISS, i, n, HMAP_FIND(strmap, &map, &((strelm_t){absent[i]})));
+  MEASURE(res, REMOVE, i, n,
+          HMAP_REMOVE(strmap, &map, &((strelm_t){keys[i]})));
+
+  HMAP_DESTROY(strmap, &map);
+  free(slots);
+  free(meta);
+}
+
+static void bench_strtree(optimes_t *res, char **keys, char **absent, int n) {
+  struct strtree tree = RB_INITIALIZER(&tree);
+  strnode_t *nodes = Malloc(n * sizeof(strnode_t));
+  strnode_t find;
+
+  MEASURE(res, INSERT, i, n,
+          (nodes[i].elm = (strelm_t){keys[i], i},
+           !RB_INSERT(strtree, &tree, &nodes[i])));
+  MEASURE(res, FIND, i, n,
+          (find.elm.key = keys[i], RB_FIND(strtree, &tree, &find)));
+  MEASURE(res, MISS, i, n,
+          (find.elm.key = absent[i], RB_FIND(strtree, &tree, &find)));
+  MEASURE(res, REMOVE, i, n, (find.elm.key = keys[i], ({
+                                strnode_t *node = RB_FIND(strtree, &tree, &find);
+                                node && RB_REMOVE(strtree, &tree, node);
+                              })));
+
+  free(nodes);
+}
+
+static void bench_pidmap(optimes_t *res, pid_t *keys, pid_t *absent, int n,
+                         bool fixed) {
+  struct pidmap map = HMAP_INITIALIZER(&map);
+  pidelm_t *slots = NULL;
+  uint32_t *meta = NULL;
+
+  if (fixed) {
+    size_t size = HMAP_MINSIZE;
+    while (size * 7 < (size_t)n * 8)
+      size *= 2;
+    slots = Malloc(size * sizeof(pidelm_t));
+    meta = Malloc(size * sizeof(uint32_t));
+    HMAP_INIT_FIXED(&map, slots, meta, size);
+  }
+
+  MEASURE(res, INSERT, i, n,
+          !HMAP_INSERT(pidmap, &map, &((pidelm_t){keys[i], i})));
+  MEASURE(res, FIND, i, n, HMAP_FIND(pidmap, &map, &((pidelm_t){keys[i]})));
+  MEASURE(res, MISS, i, n, HMAP_FIND(pidmap, &map, &((pidelm_t){absent[i]})));
+  MEASURE(res, REMOVE, i, n,
+          HMAP_REMOVE(pidmap, &map, &((pidelm_t){keys[i]})));
+
+  HMAP_DESTROY(pidmap, &map);
+  free(slots);
+  free(meta);
+}
+
+static void bench_pidtree(optimes_t *res, pid_t *keys, pid_t *absent, int n) {
+  struct pidtree tree = RB_INITIALIZER(&tree);
+  pidnode_t *nodes = Malloc(n * sizeof(pidnode_t));
+  pidnode_t find;
+
+  MEASURE(res, INSERT, i, n,
+          (nodes[i].elm = (pidelm_t){keys[i], i},
+           !RB_INSERT(pidtree, &tree, &nodes[i])));
+  MEASURE(res, FIND, i, n,
+          (find.elm.key = keys[i], RB_FIND(pidtree, &tree, &find)));
+  MEASURE(res, MISS, i, n,
+          (find.elm.key = absent[i], RB_FIND(pidtree, &tree, &find)));
+  MEASURE(res, REMOVE, i, n, (find.elm.key = keys[i], ({
+                                pidnode_t *node = RB_FIND(pidtree, &tree, &find);
+                                node && RB_REMOVE(pidtree, &tree, node);
+                              })));
+
+  free(nodes);
+}
+
+/* Distinct random name of 2 to 16 characters. */
+static char *randname(int i) {
+  char buf[32];
+  int len = 2 + random() % 15;
+  for (int j = 0; j < len; j++)
+    buf[j] = 'a' + random() % 26;
+  /* Suffix makes names unique, like numbers in names of files or jobs. */
+  snprintf(buf + len, sizeof(buf) - len, "%x", i);
+  return strdup(buf);
+}
+
+static bool report(const char *kind, const char *name, optimes_t *res, int n,
+                   int repeats, optimes_t *first) {
+  printf("%-4s %-10s", kind, name);
+  for (int op = 0; op < NOPS; op++)
+    printf(" %s %7.1fns", opname[op], res->time[op] / (n * repeats) * 1e9);
+  printf("  found %lu/%lu\n", res->hits[FIND] / repeats,
+         res->hits[MISS] / repeats);
+  for (int op = 0; op < NOPS; op++)
+    if (res->hits[op] != first->hits[op])
+      return false;
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  int n = 10000, repeats = 3, opt;
+  bool agree = true;
+
+  while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+    if (opt == 'n' && (n = atoi(optarg)) > 0)
+      continue;
+    if (opt == 'r' && (repeats = atoi(optarg)) > 0)
+      continue;
+    goto usage;
+  }
+  if (optind != argc)
+    goto usage;
+
+  char **keys = Malloc(n * sizeof(char *));
+  char **absent = Malloc(n * sizeof(char *));
+  pid_t *pids = Malloc(n * sizeof(pid_t));
+  pid_t *nopids = Malloc(n * sizeof(pid_t));
+
+  /* Absent keys differ from present ones by their suffix. */
+  srandom(1);
+  for (int i = 0; i < n; i++) {
+    keys[i] = randname(i);
+    absent[i] = randname(n + i);
+    pids[i] = 2 * i + 1000;
+    nopids[i] = 2 * i + 1001;
+  }
+
+  optimes_t strmap = {}, strfixed = {}, strtree = {};
+  optimes_t pidmap = {}, pidfixed = {}, pidtree = {};
+
+  for (int r = 0; r < repeats; r++) {
+    bench_strmap(&strmap, keys, absent, n, false);
+    bench_strmap(&strfixed, keys, absent, n, true);
+    bench_strtree(&strtree, keys, absent, n);
+    bench_pidmap(&pidmap, pids, nopids, n, false);
+    bench_pidmap(&pidfixed, pids, nopids, n, true);
+    bench_pidtree(&pidtree, pids, nopids, n);
+  }
+
+  agree &= report("str", "hashmap", &strmap, n, repeats, &strtree);
+  agree &= report("str", "fixed", &strfixed, n, repeats, &strtree);
+  agree &= report("str", "rbtree", &strtree, n, repeats, &strtree);
+  agree &= report("pid", "hashmap", &pidmap, n, repeats, &pidtree);
+  agree &= report("pid", "fixed", &pidfixed, n, repeats, &pidtree);
+  agree &= report("pid", "rbtree", &pidtree, n, repeats, &pidtree);
+
+  for (int i = 0; i < n; i++) {
+    free(keys[i]);
+    free(absent[i]);
+  }
+  free(keys);
+  free(absent);
+  free(pids);
+  free(nopids);
+
+  if (!agree) {
+    fprintf(stderr, "hmapbench: data structures do not agree\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+
+usage:
+  fprintf(stderr, "usage: %s [-n keys] [-r repeats]\n", argv[0]);
+  return EXIT_FAILURE;
+}
@@ -7,6 +7,7 @@
 #include <sys/sysmacros.h>
 #include <sys/prctl.h>
 #endif
+#include <sys/resource.h>
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -83,12 +84,55 @@ noreturn void gai_error(int code, const char *fmt, ...)
 /* Signal safe I/O functions */
 void safe_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 void safe_error(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void safe_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void safe_logflush(int fd);
+
+/* JSON string literal of `s`, truncated to fit in `buf`. */
+char *jsonstr(char *buf, size_t size, const char *s);
 
 /* Decent hashing function. */
 #define HASHINIT 5381
 
 uint32_t jenkins_hash(const void *key, size_t length, uint32_t initval);
 
+/* Instrumentation of wrappers, compiled in with -DCSAPP_STATS. Every call made
+ * with WRAPSTAT is counted, timed and, if it returned -1 with errno other than
+ * EINTR, counted as an error. Records of wrappers linked into the program are
+ * gathered in "wrapstat" section and visited with wrapstat_foreach. */
+typedef struct wrapstat {
+  const char *name;
+  unsigned long calls, errors;
+  uint64_t nsecs, maxnsecs;
+} __attribute__((aligned(64))) wrapstat_t;
+
+#ifdef CSAPP_STATS
+extern wrapstat_t __start_wrapstat[] __attribute__((weak));
+extern wrapstat_t __stop_wrapstat[] __attribute__((weak));
+
+void wrapstat_account(wrapstat_t *ws, const struct timespec *start,
+                      bool failed);
+void wrapstat_reset(void);
+
+#define WRAPSTAT(wrapper, call)                                                \
+  ({                                                                           \
+    static wrapstat_t _ws __attribute__((section("wrapstat"), used)) = {       \
+      .name = #wrapper};                                                       \
+    struct timespec _start;                                                    \
+    clock_gettime(CLOCK_MONOTONIC, &_start);                                   \
+    typeof(call) _rc = (call);                                                 \
+    wrapstat_account(&_ws, &_start,                                            \
+                     _rc == (typeof(_rc))(intptr_t)-1 && errno != EINTR);      \
+    _rc;                                                                       \
+  })
+
+#define wrapstat_foreach(ws)                                                   \
+  for (wrapstat_t *ws = __start_wrapstat; ws && ws < __stop_wrapstat; ws++)
+#else
+#define WRAPSTAT(wrapper, call) (call)
+#define wrapstat_foreach(ws) for (wrapstat_t *ws = NULL; ws; ws++)
+#define wrapstat_reset()
+#endif
+
 /* Memory allocation wrappers */
 void *Malloc(size_t size);
 void *Realloc(void *ptr, size_t size);
@@ -134,6 +178,23 @@ int Select(int n, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
            struct timeval *timeout);
 int Poll(struct pollfd *fds, nfds_t nfds, int timeout);
 
+/* Moving data between pipes without copying (Linux specific) */
+#ifdef LINUX
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#define SPLICE_F_NONBLOCK 2
+#define SPLICE_F_MORE 4
+#endif
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#define F_GETPIPE_SZ 1032
+#endif
+
+size_t Splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+              size_t len, unsigned flags);
+size_t Tee(int fd_in, int fd_out, size_t len, unsigned flags);
+#endif
+
 /* Directory access (Linux specific) */
 struct linux_dirent {
   unsigned long d_ino;     /* Inode number */
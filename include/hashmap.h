@@ -0,0 +1,236 @@
+#ifndef _HASHMAP_H_
+#define _HASHMAP_H_
+
+/*
+ * This file defines a hash map with open addressing and robin hood hashing.
+ *
+ * Elements are kept by value in an array of slots. An element is placed as
+ * close to the slot selected by its hash (home slot) as possible. While
+ * inserting, an element that is closer to its home slot than the one being
+ * inserted gives up its slot and moves further, so distances from home slots
+ * stay short and a lookup may stop as soon as it meets an element closer to
+ * home than the key would be. Removal shifts following elements back one slot
+ * instead of leaving a tombstone behind.
+ *
+ * Each slot has a metadata word: upper 24 bits of hash and distance from
+ * home slot plus one in the lower 8 bits, or zero if the slot is empty. Most
+ * mismatches are rejected by comparing metadata, without touching elements.
+ *
+ * By default slots are allocated on heap and their number is doubled when
+ * the map gets 7/8 full. A map may instead be given a fixed pool of slots
+ * with HMAP_INIT_FIXED, e.g. to be used where allocation is not allowed such
+ * as in a signal handler. Such map never grows and insertion fails when it
+ * is full.
+ *
+ * Pointers to elements are valid only until the map is modified.
+ *
+ * Functions are generated by HMAP_GENERATE(name, type, hash, equal), where
+ * `hash` returns uint32_t hash of key of an element, and `equal` tells
+ * whether keys of two elements are equal.
+ */
+
+#define HMAP_MINSIZE 16
+#define HMAP_MAXDIST 255
+
+#define HMAP_HEAD(name, type)                                                  \
+  struct name {                                                                \
+    struct type *hmh_slots; /* elements */                                     \
+    uint32_t *hmh_meta;     /* hash and distance of each slot, 0 if empty */   \
+    uint32_t hmh_mask;      /* number of slots minus one */                    \
+    uint32_t hmh_count;     /* number of elements */                           \
+    bool hmh_fixed;         /* slots provided by user, never grown */          \
+  }
+
+#define HMAP_INITIALIZER(head)                                                 \
+  { NULL, NULL, 0, 0, false }
+
+#define HMAP_INIT(head)                                                        \
+  do {                                                                         \
+    (head)->hmh_slots = NULL;                                                  \
+    (head)->hmh_meta = NULL;                                                   \
+    (head)->hmh_mask = 0;                                                      \
+    (head)->hmh_count = 0;                                                     \
+    (head)->hmh_fixed = false;                                                 \
+  } while (/*CONSTCOND*/ 0)
+
+/* Use `n` slots of `slots` and `meta` arrays, `n` must be a power of two. */
+#define HMAP_INIT_FIXED(head, slots, meta, n)                                  \
+  do {                                                                         \
+    assert(powerof2(n));                                                       \
+    (head)->hmh_slots = (slots);                                               \
+    (head)->hmh_meta = (meta);                                                 \
+    memset((head)->hmh_meta, 0, (n) * sizeof(uint32_t));                       \
+    (head)->hmh_mask = (n)-1;                                                  \
+    (head)->hmh_count = 0;                                                     \
+    (head)->hmh_fixed = true;                                                  \
+  } while (/*CONSTCOND*/ 0)
+
+#define HMAP_COUNT(head) (head)->hmh_count
+#define HMAP_EMPTY(head) ((head)->hmh_count == 0)
+#define HMAP_SIZE(head) ((head)->hmh_slots ? (head)->hmh_mask + 1 : 0)
+
+#define HMAP_META(hash, dist) (((hash) & ~(uint32_t)HMAP_MAXDIST) | (dist))
+#define HMAP_DIST(meta) ((meta)&HMAP_MAXDIST)
+
+/* Generates prototypes */
+#define HMAP_PROTOTYPE(name, type, hash, equal)                                \
+  HMAP_PROTOTYPE_INTERNAL(name, type, hash, equal, )
+#define HMAP_PROTOTYPE_STATIC(name, type, hash, equal)                         \
+  HMAP_PROTOTYPE_INTERNAL(name, type, hash, equal, __unused static)
+#define HMAP_PROTOTYPE_INTERNAL(name, type, hash, equal, attr)                 \
+  attr struct type *name##_HMAP_FIND(struct name *, const struct type *);      \
+  attr struct type *name##_HMAP_INSERT(struct name *, const struct type *);    \
+  attr bool name##_HMAP_REMOVE(struct name *, struct type *);                  \
+  attr void name##_HMAP_DESTROY(struct name *);                                \
+  attr struct type *name##_HMAP_NEXT(struct name *, struct type *);
+
+#define HMAP_GENERATE(name, type, hash, equal)                                 \
+  HMAP_GENERATE_INTERNAL(name, type, hash, equal, )
+#define HMAP_GENERATE_STATIC(name, type, hash, equal)                          \
+  HMAP_GENERATE_INTERNAL(name, type, hash, equal, __unused static)
+#define HMAP_GENERATE_INTERNAL(name, type, hash, equal, attr)                  \
+  /* Index of slot holding element equal to elm, or -1 if there is none. */    \
+  static inline long name##_HMAP_LOOKUP(struct name *head,                     \
+                                        const struct type *elm) {              \
+    if (head->hmh_count == 0)                                                  \
+      return -1;                                                               \
+    uint32_t h = hash(elm), i = h & head->hmh_mask, meta;                      \
+    for (uint32_t d = 1;; d++, i = (i + 1) & head->hmh_mask) {                 \
+      meta = head->hmh_meta[i];                                                \
+      if (HMAP_DIST(meta) < d)                                                 \
+        return -1;                                                             \
+      if (meta == HMAP_META(h, d) && equal(&head->hmh_slots[i], elm))          \
+        return i;                                                              \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  attr struct type *name##_HMAP_FIND(struct name *head,                        \
+                                     const struct type *elm) {                 \
+    long i = name##_HMAP_LOOKUP(head, elm);                                    \
+    return i < 0 ? NULL : &head->hmh_slots[i];                                 \
+  }                                                                            \
+                                                                               \
+  /* Place an element that is not in the map yet. Returns false if some      \
+   * element got too far from its home slot. That element is left in *elm    \
+   * and the map must grow before it is placed again. */                      \
+  static bool name##_HMAP_PLACE(struct name *head, struct type *elm,          \
+                                uint32_t h) {                                  \
+    uint32_t i = h & head->hmh_mask, meta = HMAP_META(h, 1);                   \
+    for (;; i = (i + 1) & head->hmh_mask) {                                    \
+      uint32_t other = head->hmh_meta[i];                                      \
+      if (other == 0) {                                                        \
+        head->hmh_meta[i] = meta;                                              \
+        head->hmh_slots[i] = *elm;                                             \
+        return true;                                                           \
+      }                                                                        \
+      if (HMAP_DIST(other) < HMAP_DIST(meta)) {                                \
+        /* Take the slot from element that is closer to its home. */           \
+        struct type tmp = head->hmh_slots[i];                                  \
+        head->hmh_slots[i] = *elm;                                             \
+        head->hmh_meta[i] = meta;                                              \
+        *elm = tmp;                                                            \
+        meta = other;                                                          \
+      }                                                                        \
+      if (HMAP_DIST(meta) == HMAP_MAXDIST)                                     \
+        return false;                                                          \
+      meta++;                                                                  \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void name##_HMAP_GROW(struct name *head) {                            \
+    uint32_t oldsize = HMAP_SIZE(head);                                        \
+    struct type *slots = head->hmh_slots;                                      \
+    uint32_t *meta = head->hmh_meta;                                           \
+    uint32_t size = oldsize ? oldsize * 2 : HMAP_MINSIZE;                      \
+    head->hmh_slots = Malloc(size * sizeof(struct type));                      \
+    head->hmh_meta = Calloc(size, sizeof(uint32_t));                           \
+    head->hmh_mask = size - 1;                                                 \
+    for (uint32_t i = 0; i < oldsize; i++) {                                   \
+      if (meta[i] == 0)                                                        \
+        continue;                                                              \
+      struct type tmp = slots[i];                                              \
+      if (!name##_HMAP_PLACE(head, &tmp, hash(&tmp)))                          \
+        abort(); /* hash function is hopeless */                               \
+    }                                                                          \
+    free(slots);                                                               \
+    free(meta);                                                                \
+  }                                                                            \
+                                                                               \
+  /* Returns element in the map with the same key as elm, NULL if elm was     \
+   * inserted, or elm itself if a fixed map has no room for it. */            \
+  attr struct type *name##_HMAP_INSERT(struct name *head,                      \
+                                       const struct type *elm) {               \
+    long i = name##_HMAP_LOOKUP(head, elm);                                    \
+    if (i >= 0)                                                                \
+      return &head->hmh_slots[i];                                              \
+    uint32_t size = HMAP_SIZE(head);                                           \
+    if ((head->hmh_count + 1) * 8 > size * 7) {                                \
+      if (head->hmh_fixed)                                                     \
+        return (struct type *)elm;                                             \
+      name##_HMAP_GROW(head);                                                  \
+    }                                                                          \
+    struct type tmp = *elm;                                                    \
+    while (!name##_HMAP_PLACE(head, &tmp, hash(&tmp))) {                       \
+      /* A fixed map is never that full with a decent hash function. */       \
+      if (head->hmh_fixed)                                                     \
+        abort();                                                               \
+      name##_HMAP_GROW(head);                                                  \
+    }                                                                          \
+    head->hmh_count++;                                                         \
+    return NULL;                                                               \
+  }                                                                            \
+                                                                               \
+  /* Remove element with the same key as elm and store it in elm. */          \
+  attr bool name##_HMAP_REMOVE(struct name *head, struct type *elm) {          \
+    long i = name##_HMAP_LOOKUP(head, elm);                                    \
+    if (i < 0)                                                                 \
+      return false;                                                            \
+    *elm = head->hmh_slots[i];                                                 \
+    uint32_t j = (i + 1) & head->hmh_mask;                                     \
+    while (HMAP_DIST(head->hmh_meta[j]) > 1) {                                 \
+      head->hmh_slots[i] = head->hmh_slots[j];                                 \
+      head->hmh_meta[i] = head->hmh_meta[j] - 1;                               \
+      i = j;                                                                   \
+      j = (j + 1) & head->hmh_mask;                                            \
+    }                                                                          \
+    head->hmh_meta[i] = 0;                                                     \
+    head->hmh_count--;                                                         \
+    return true;                                                               \
+  }                                                                            \
+                                                                               \
+  attr void name##_HMAP_DESTROY(struct name *head) {                           \
+    if (!head->hmh_fixed) {                                                    \
+      free(head->hmh_slots);                                                   \
+      free(head->hmh_meta);                                                    \
+      HMAP_INIT(head);                                                         \
+    } else {                                                                   \
+      memset(head->hmh_meta, 0, HMAP_SIZE(head) * sizeof(uint32_t));           \
+      head->hmh_count = 0;                                                     \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  /* Element following elm in slot order, or the first one if elm is NULL. */ \
+  attr struct type *name##_HMAP_NEXT(struct name *head, struct type *elm) {    \
+    uint32_t i = elm ? elm - head->hmh_slots + 1 : 0;                          \
+    for (; i < HMAP_SIZE(head); i++)                                           \
+      if (head->hmh_meta[i])                                                   \
+        return &head->hmh_slots[i];                                            \
+    return NULL;                                                               \
+  }
+
+#define HMAP_FIND(name, x, y) CONCAT(name, _HMAP_FIND(x, y))
+#define HMAP_INSERT(name, x, y) CONCAT(name, _HMAP_INSERT(x, y))
+#define HMAP_REMOVE(name, x, y) CONCAT(name, _HMAP_REMOVE(x, y))
+#define HMAP_DESTROY(name, x) CONCAT(name, _HMAP_DESTROY(x))
+#define HMAP_NEXT(name, x, y) CONCAT(name, _HMAP_NEXT(x, y))
+
+#define HMAP_FOREACH(x, name, head)                                            \
+  for ((x) = HMAP_NEXT(name, head, NULL); (x) != NULL;                         \
+       (x) = HMAP_NEXT(name, head, x))
+
+/* Hash of a NUL-terminated string, for use in `hash` functions. */
+static inline uint32_t hmap_strhash(const char *s) {
+  return jenkins_hash(s, strlen(s), HASHINIT);
+}
+
+#endif /* !_HASHMAP_H_ */
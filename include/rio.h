@@ -4,24 +4,59 @@
 /* Persistent state for the robust I/O (Rio) package */
 #define RIO_BUFSIZE 8192
 
+typedef struct {
+  int rio_fd;                  /* Descriptor for this internal buf */
+  ssize_t rio_cnt;             /* Unread bytes in internal buf */
+  char *rio_bufptr;            /* Next unread byte in internal buf */
+  char *rio_buf;               /* Internal buffer: rio_fixed, heap or mapping */
+  size_t rio_bufsize;          /* Size of internal buffer */
+  size_t rio_mapsize;          /* Size of mapped file, 0 if not mapped */
+  char rio_fixed[RIO_BUFSIZE]; /* Default internal buffer */
+} rio_t;
+
+/* A line inside of internal buffer of rio_t, including the newline character
+ * unless it is the last line of input. Valid until next read from rio_t. */
+typedef struct {
+  char *ptr;
+  size_t len;
+} rio_line_t;
+
+/* Buffered writer. Small writes are copied to internal buffer, which is
+ * written out when full or when rio_flushb is called. */
 typedef struct {
   int rio_fd;                /* Descriptor for this internal buf */
-  int rio_cnt;               /* Unread bytes in internal buf */
-  char *rio_bufptr;          /* Next unread byte in internal buf */
+  size_t rio_cnt;            /* Unwritten bytes in internal buf */
   char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
-} rio_t;
+} rio_writer_t;
 
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, const void *usrbuf, size_t n);
+ssize_t rio_writevn(int fd, struct iovec *iov, int iovcnt);
 void rio_readinitb(rio_t *rp, int fd);
+void rio_readinitb_size(rio_t *rp, int fd, size_t bufsize);
+void rio_readinitm(rio_t *rp, int fd);
+void rio_readfreeb(rio_t *rp);
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_readlinev(rio_t *rp, rio_line_t *line);
+void rio_writeinitb(rio_writer_t *wp, int fd);
+ssize_t rio_writeb(rio_writer_t *wp, const void *usrbuf, size_t n);
+ssize_t rio_writevb(rio_writer_t *wp, const struct iovec *iov, int iovcnt);
+ssize_t rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+int rio_flushb(rio_writer_t *wp);
 
 /* Wrappers that exit on failure */
 ssize_t Rio_readn(int fd, void *ptr, size_t nbytes);
 void Rio_writen(int fd, const void *usrbuf, size_t n);
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_readlinev(rio_t *rp, rio_line_t *line);
+void Rio_writeb(rio_writer_t *wp, const void *usrbuf, size_t n);
+void Rio_writevb(rio_writer_t *wp, const struct iovec *iov, int iovcnt);
+void Rio_printfb(rio_writer_t *wp, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+void Rio_flushb(rio_writer_t *wp);
 
 #endif /* !_RIO_H_ */
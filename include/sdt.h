@@ -0,0 +1,101 @@
+#ifndef _SDT_H_
+#define _SDT_H_
+
+/*
+ * Statically defined tracing probes compatible with SystemTap's <sys/sdt.h>,
+ * hence understood by perf, bpftrace, gdb and systemtap:
+ *
+ *   SDT_PROBE2(provider, name, arg1, arg2);
+ *
+ * A probe is a single nop instruction. Its address and a description of where
+ * its arguments live are recorded in an ELF note in .note.stapsdt section,
+ * which is not loaded into memory, so a probe costs nothing until a tracer
+ * replaces the nop with a breakpoint. Use `readelf -n` to list probes.
+ *
+ * Arguments must be integers (cast pointers to uintptr_t) and should be cheap
+ * to compute, since they get evaluated whether a tracer is attached or not.
+ * Double underscore in a probe name is displayed by tools as a dash.
+ */
+
+#if defined(__ELF__) && !defined(SDT_DISABLE)
+
+#ifdef __LP64__
+#define _SDT_ADDR ".8byte"
+#else
+#define _SDT_ADDR ".4byte"
+#endif
+
+/* An argument is described as "[-]size@operand", negative size for signed
+ * types. The compiler prints the operand, so it may be a register, a memory
+ * reference or a constant, whatever is at hand at the probe site. */
+#define _SDT_SIGNED(x) ((__typeof__((x) + 0))-1 < 1)
+#define _SDT_ARG(n, x)                                                         \
+  [_SDT_S##n] "n"((_SDT_SIGNED(x) ? 1 : -1) * (int)sizeof((x) + 0)),           \
+    [_SDT_A##n] "nor"((x) + 0)
+#define _SDT_FMT(n) "%n[_SDT_S" #n "]@%[_SDT_A" #n "]"
+
+/* Note of type 3 named "stapsdt" holds: probe address, address of
+ * _.stapsdt.base (so tools can account for prelinking), semaphore address
+ * (unused, always 0), provider, name and argument descriptions. */
+#define _SDT_PROBE(provider, name, args)                                       \
+  "990: nop\n"                                                                 \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                \
+  ".balign 4\n"                                                                \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                           \
+  "991: .asciz \"stapsdt\"\n"                                                  \
+  "992: .balign 4\n"                                                           \
+  "993: " _SDT_ADDR " 990b\n"                                                  \
+  _SDT_ADDR " _.stapsdt.base\n"                                                \
+  _SDT_ADDR " 0\n"                                                             \
+  ".asciz \"" #provider "\"\n"                                                 \
+  ".asciz \"" #name "\"\n"                                                     \
+  ".asciz \"" args "\"\n"                                                      \
+  "994: .balign 4\n"                                                           \
+  ".popsection\n"                                                              \
+  ".ifndef _.stapsdt.base\n"                                                   \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"      \
+  ".weak _.stapsdt.base\n"                                                     \
+  ".hidden _.stapsdt.base\n"                                                   \
+  "_.stapsdt.base: .space 1\n"                                                 \
+  ".size _.stapsdt.base, 1\n"                                                  \
+  ".popsection\n"                                                              \
+  ".endif\n"
+
+#define _SDT_ASM(provider, name, args, ...)                                    \
+  __asm__ __volatile__(_SDT_PROBE(provider, name, args) : : __VA_ARGS__)
+
+#define SDT_PROBE0(provider, name) _SDT_ASM(provider, name, "")
+#define SDT_PROBE1(provider, name, a1)                                         \
+  _SDT_ASM(provider, name, _SDT_FMT(1), _SDT_ARG(1, a1))
+#define SDT_PROBE2(provider, name, a1, a2)                                     \
+  _SDT_ASM(provider, name, _SDT_FMT(1) " " _SDT_FMT(2), _SDT_ARG(1, a1),       \
+           _SDT_ARG(2, a2))
+#define SDT_PROBE3(provider, name, a1, a2, a3)                                 \
+  _SDT_ASM(provider, name, _SDT_FMT(1) " " _SDT_FMT(2) " " _SDT_FMT(3),        \
+           _SDT_ARG(1, a1), _SDT_ARG(2, a2), _SDT_ARG(3, a3))
+#define SDT_PROBE4(provider, name, a1, a2, a3, a4)                             \
+  _SDT_ASM(provider, name,                                                     \
+           _SDT_FMT(1) " " _SDT_FMT(2) " " _SDT_FMT(3) " " _SDT_FMT(4),        \
+           _SDT_ARG(1, a1), _SDT_ARG(2, a2), _SDT_ARG(3, a3), _SDT_ARG(4, a4))
+#define SDT_PROBE5(provider, name, a1, a2, a3, a4, a5)                         \
+  _SDT_ASM(provider, name,                                                     \
+           _SDT_FMT(1) " " _SDT_FMT(2) " " _SDT_FMT(3) " " _SDT_FMT(4) " "     \
+             _SDT_FMT(5),                                                      \
+           _SDT_ARG(1, a1), _SDT_ARG(2, a2), _SDT_ARG(3, a3), _SDT_ARG(4, a4), \
+           _SDT_ARG(5, a5))
+
+#else /* !__ELF__ || SDT_DISABLE */
+
+#define SDT_PROBE0(provider, name) ((void)0)
+#define SDT_PROBE1(provider, name, a1) ((void)(a1))
+#define SDT_PROBE2(provider, name, a1, a2) ((void)(a1), (void)(a2))
+#define SDT_PROBE3(provider, name, a1, a2, a3)                                 \
+  ((void)(a1), (void)(a2), (void)(a3))
+#define SDT_PROBE4(provider, name, a1, a2, a3, a4)                             \
+  ((void)(a1), (void)(a2), (void)(a3), (void)(a4))
+#define SDT_PROBE5(provider, name, a1, a2, a3, a4, a5)                         \
+  ((void)(a1), (void)(a2), (void)(a3), (void)(a4), (void)(a5))
+
+#endif /* !__ELF__ || SDT_DISABLE */
+
+#endif /* !_SDT_H_ */
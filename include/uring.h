@@ -0,0 +1,50 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+/*
+ * Batched I/O (Linux specific). An array of requests is submitted to kernel
+ * with io_uring in as few system calls as possible and results are collected
+ * from completion queue. If io_uring is not available, e.g. it was disabled
+ * by administrator, or an operation is not supported by running kernel,
+ * requests are carried out one by one with plain system calls.
+ */
+
+#ifdef LINUX
+#include <linux/stat.h>
+
+enum {
+  URING_READ,   /* read `len` bytes from `fd` into `buf` */
+  URING_WRITE,  /* write `len` bytes from `buf` to `fd` */
+  URING_SPLICE, /* move `len` bytes from `fd` to `fd_out`, one must be a pipe */
+  URING_STATX,  /* statx of `path` relative to `fd` into `buf` */
+};
+
+typedef struct {
+  int op;           /* one of URING_* */
+  int fd;           /* descriptor to operate on or AT_FDCWD */
+  int fd_out;       /* destination of splice */
+  void *buf;        /* data buffer or struct statx */
+  size_t len;       /* size of transfer */
+  off_t off;        /* offset in `fd`, -1 to use and advance file position */
+  const char *path; /* file to statx */
+  ssize_t result;   /* transferred bytes or 0 on success, -errno on failure */
+} uring_req_t;
+
+typedef struct {
+  int fd;            /* io_uring descriptor, -1 if requests are not batched */
+  unsigned entries;  /* size of submission queue */
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  void *sqes, *cqes; /* submission and completion queue entries */
+  void *sq_ring, *cq_ring;
+  size_t sq_size, cq_size;
+  unsigned long ops; /* bitmap of URING_* supported by kernel */
+} uring_t;
+
+int uring_init(uring_t *ring, unsigned entries);
+void uring_free(uring_t *ring);
+int uring_run(uring_t *ring, uring_req_t *req, int nreq);
+
+#endif /* !LINUX */
+
+#endif /* !_URING_H_ */
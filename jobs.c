@@ -1,25 +1,132 @@
-#include "shell.h"
-
-typedef struct proc {
-  pid_t pid;    /* process identifier */
-  int state;    /* RUNNING or STOPPED or FINISHED */
-  int exitcode; /* -1 if exit status not yet received */
-} proc_t;
-
-typedef struct job {
-  pid_t pgid;            /* 0 if slot is free */
-  proc_t *proc;          /* array of processes running in as a job */
-  struct termios tmodes; /* saved terminal modes */
-  int nproc;             /* number of processes */
-  int state;             /* changes when live processes have same state */
-  char *command;         /* textual representation of command line */
-} job_t;
-
-static job_t *jobs = NULL;          /* array of all jobs */
-static int njobmax = 1;             /* number of slots in jobs array */
+#include "jobs.h"
+#include "rio.h"
+#include <math.h>
+
+/* Seconds jobs are given to exit when the shell quits before they are sent
+ * SIGKILL. Can be overridden with SHUTDOWN_GRACE environment variable. */
+#define SHUTDOWN_GRACE 3.0
+
+#ifdef LINUX
+#include <sys/syscall.h>
+#endif
+
+job_t *jobs = NULL;                 /* array of all jobs */
+int njobmax = 1;                    /* number of slots in jobs array */
+static int reserved = 0;            /* slot kept for a job leaving the queue */
+static unsigned long lastserial = 0; /* serial of most recently created job */
 static int tty_fd = -1;             /* controlling terminal file descriptor */
 static struct termios shell_tmodes; /* saved shell terminal modes */
 
+/* State of `time` keyword measurement. */
+static struct {
+  struct timespec start; /* when the command was started */
+  struct rusage self;    /* resources used by the shell until then */
+  proc_t *proc;          /* processes of the foreground job once finished */
+  int nproc;             /* number of entries in `proc` */
+} timing;
+
+/* When pipeline is done, its exitcode is fetched from the last process. */
+static int exitcode(job_t *job) {
+  return job->proc[job->nproc - 1].exitcode;
+}
+
+/* Job has finished, so let go jobs that have been waiting for it. Dependents
+ * that required it to succeed are cancelled if it failed or never started.
+ * Called from the reaper, hence it must be async-signal-safe. */
+static void release(job_t *job) {
+  bool failed = job->nproc == 0 || exitcode(job) != 0;
+
+  for (int j = BG; j < njobmax; j++) {
+    job_t *dep = &jobs[j];
+    if (dep->state != QUEUED)
+      continue;
+    for (int i = 0; i < dep->nafter; i++) {
+      if (dep->after[i] != job->serial)
+        continue;
+      dep->after[i] = dep->after[--dep->nafter];
+      if (failed && dep->afterok) {
+        dep->state = FINISHED;
+        release(dep);
+      }
+      break;
+    }
+  }
+}
+
+#ifdef LINUX
+/* Parse a decimal number following `key` in `buf`. */
+static unsigned long iostat(const char *buf, const char *key) {
+  const char *p = strstr(buf, key);
+  unsigned long n = 0;
+  if (p)
+    for (p += strlen(key); *p == ' '; p++)
+      ;
+  for (; p && isdigit(*p); p++)
+    n = n * 10 + (*p - '0');
+  return n;
+}
+
+/* Fetch I/O counters of a process that has not been buried yet. */
+static void readio(pid_t pid, usage_t *u) {
+  char path[32] = "/proc/", num[16], buf[256];
+  int i = sizeof(num);
+
+  num[--i] = '\0';
+  do {
+    num[--i] = '0' + pid % 10;
+  } while (pid /= 10);
+  strcat(strcat(path, &num[i]), "/io");
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return;
+  buf[n] = '\0';
+  u->rchar = iostat(buf, "rchar:");
+  u->wchar = iostat(buf, "wchar:");
+}
+#endif
+
+/* Fetch a state change of the process, if it has one to report. The state is
+ * peeked at first and waitpid(2) is called only if there is one, so a process
+ * that terminates right after the peek is left for the next SIGCHLD rather
+ * than reaped before resources it used are gathered. Those are gathered from
+ * a zombie, while its /proc entry still exists, which then has nothing else
+ * to report. Only a process killed right after the peek saw it stop or
+ * continue is reaped without them. Returns the pid as waitpid(2) does. Must be
+ * async-signal-safe. */
+static pid_t reap(proc_t *proc, int *statusp) {
+  int options = WNOHANG | WUNTRACED | WCONTINUED;
+#ifdef LINUX
+  siginfo_t si = {.si_pid = 0};
+  struct rusage ru;
+
+  /* Unlike waitid(3) the system call reports resource usage as well. */
+  if (syscall(SYS_waitid, P_PID, proc->pid, &si,
+              WEXITED | WSTOPPED | WCONTINUED | WNOHANG | WNOWAIT, &ru) < 0 ||
+      si.si_pid != proc->pid)
+    return 0;
+
+  if (si.si_code != CLD_STOPPED && si.si_code != CLD_CONTINUED) {
+    usage_t *u = &proc->usage;
+    u->utime = ru.ru_utime;
+    u->stime = ru.ru_stime;
+    u->maxrss = ru.ru_maxrss;
+    u->nvcsw = ru.ru_nvcsw;
+    u->nivcsw = ru.ru_nivcsw;
+    u->faults = ru.ru_minflt + ru.ru_majflt;
+    readio(proc->pid, u);
+    perf_read(proc->perf, proc->counter);
+    options = WNOHANG;
+  }
+#endif
+  STAT_INC(waitpid);
+  return waitpid(proc->pid, statusp, options);
+}
+
 static void sigchld_handler(int sig) {
   int old_errno = errno;
   pid_t pid;
@@ -27,30 +134,41 @@ static void sigchld_handler(int sig) {
   /* TODO: Change state (FINISHED, RUNNING, STOPPED) of processes and jobs.
    * Bury all children that finished saving their status in jobs. */
 #ifdef STUDENT
+  STAT_INC(sigchld);
   for (int i = 0; i < njobmax; i++) {
     job_t *j = &jobs[i];
     if (j->pgid == 0)
       continue;
     for (int p = 0; p < j->nproc; p++) {
-      pid = waitpid(j->proc[p].pid, &status, WNOHANG | WUNTRACED | WCONTINUED);
+      pid = reap(&j->proc[p], &status);
       if (pid <= 0)
         continue;
       if (WIFSTOPPED(status)) {
         j->state = STOPPED;
         j->proc[p].state = STOPPED;
+        record(&j->journal, EV_STOPPED, pid, status);
       } else if (WIFCONTINUED(status)) {
         j->state = RUNNING;
         j->proc[p].state = RUNNING;
+        record(&j->journal, EV_CONTINUED, pid, status);
       } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
         j->proc[p].state = FINISHED;
+        record(&j->journal, EV_EXITED, pid, status);
         j->proc[p].exitcode = status;
+        clock_gettime(CLOCK_MONOTONIC, &j->proc[p].finished);
+        shstat_hist(&shstat->exec2reap,
+                    usecs(&j->proc[p].started, &j->proc[p].finished));
         int done = 0;
         for (int k = 0; k < j->nproc; k++)
           if (j->proc[k].state == FINISHED)
             done++;
-        if (done == j->nproc)
+        if (done == j->nproc) {
           j->state = FINISHED;
+          release(j);
+        }
       }
+      SDT_PROBE5(shell, proc__state, i, pid, j->pgid, j->proc[p].state,
+                 status);
     }
   }
   (void)status;
@@ -59,12 +177,14 @@ static void sigchld_handler(int sig) {
   errno = old_errno;
 }
 
-/* When pipeline is done, its exitcode is fetched from the last process. */
-static int exitcode(job_t *job) {
-  return job->proc[job->nproc - 1].exitcode;
-}
-
 static int allocjob(void) {
+  /* Job that left the queue keeps its number. */
+  if (reserved > 0) {
+    int j = reserved;
+    reserved = 0;
+    return j;
+  }
+
   /* Find empty slot for background job. */
   for (int j = BG; j < njobmax; j++)
     if (jobs[j].pgid == 0)
@@ -83,8 +203,14 @@ static int allocproc(int j) {
 }
 
 int addjob(pid_t pgid, int bg) {
+  bool dequeued = bg && reserved > 0;
   int j = bg ? allocjob() : FG;
   job_t *job = &jobs[j];
+  /* Job that left the queue retains its identity for its dependents. */
+  if (!dequeued) {
+    job->serial = ++lastserial;
+    job->journal.nevents = 0;
+  }
   /* Initial state of a job. */
   job->pgid = pgid;
   job->state = RUNNING;
@@ -92,15 +218,37 @@ int addjob(pid_t pgid, int bg) {
   job->proc = NULL;
   job->nproc = 0;
   job->tmodes = shell_tmodes;
+  record(&job->journal, EV_CREATED, pgid, 0);
   return j;
 }
 
+static void freeprocs(proc_t *proc, int nproc) {
+  for (int i = 0; i < nproc; i++) {
+    for (int k = 0; k < NCOUNTERS; k++)
+      if (proc[i].perf[k] >= 0)
+        close(proc[i].perf[k]);
+    if (proc[i].sample.statfd >= 0)
+      close(proc[i].sample.statfd);
+    if (proc[i].sample.statmfd >= 0)
+      close(proc[i].sample.statmfd);
+    free(proc[i].command);
+  }
+  free(proc);
+}
+
 static void deljob(job_t *job) {
   assert(job->state == FINISHED);
+  if (job->pgid)
+    archive(job, job - jobs);
+  freeprocs(job->proc, job->nproc);
   free(job->command);
-  free(job->proc);
+  free(job->cmdline);
+  free(job->after);
   job->pgid = 0;
   job->command = NULL;
+  job->cmdline = NULL;
+  job->after = NULL;
+  job->nafter = 0;
   job->proc = NULL;
   job->nproc = 0;
 }
@@ -131,9 +279,32 @@ void addproc(int j, pid_t pid, char **argv) {
   proc->pid = pid;
   proc->state = RUNNING;
   proc->exitcode = -1;
+  proc->command = NULL;
+  clock_gettime(CLOCK_MONOTONIC, &proc->started);
+  SDT_PROBE4(shell, proc__spawn, j, pid, job->pgid, proc->state);
+  record(&job->journal, EV_FORKED, pid, 0);
+  memset(&proc->usage, 0, sizeof(usage_t));
+  memset(&proc->sample, 0, sizeof(sample_t));
+  proc->sample.statfd = proc->sample.statmfd = -1;
+  for (int i = 0; i < NCOUNTERS; i++) {
+    proc->perf[i] = -1;
+    proc->counted[i] = false;
+    proc->counter[i] = NOTCOUNTED;
+  }
+  mkcommand(&proc->command, argv);
   mkcommand(&job->command, argv);
 }
 
+/* Attach performance counters to the process most recently added to a job. */
+void addcounters(int j, int fd[NCOUNTERS]) {
+  assert(j < njobmax && jobs[j].nproc > 0);
+  proc_t *proc = &jobs[j].proc[jobs[j].nproc - 1];
+  for (int i = 0; i < NCOUNTERS; i++) {
+    proc->perf[i] = fd[i];
+    proc->counted[i] = fd[i] >= 0;
+  }
+}
+
 /* Returns job's state.
  * If it's finished, delete it and return exitcode through statusp. */
 static int jobstate(int j, int *statusp) {
@@ -145,6 +316,14 @@ static int jobstate(int j, int *statusp) {
 #ifdef STUDENT
   if (state == FINISHED) {
     *statusp = exitcode(job);
+    /* Processes of a foreground job may still be needed by `time`. */
+    if (j == FG) {
+      freeprocs(timing.proc, timing.nproc);
+      timing.proc = job->proc;
+      timing.nproc = job->nproc;
+      job->proc = NULL;
+      job->nproc = 0;
+    }
     deljob(job);
   }
   (void)exitcode;
@@ -153,6 +332,154 @@ static int jobstate(int j, int *statusp) {
   return state;
 }
 
+/* Number of background jobs that are running, i.e. compete for CPU. */
+static int runningjobs(void) {
+  int n = 0;
+  for (int j = BG; j < njobmax; j++)
+    if (jobs[j].pgid > 0 && jobs[j].state == RUNNING)
+      n++;
+  return n;
+}
+
+/* Returns the job that has been waiting in the queue for the longest time and
+ * does not depend on any unfinished job, or 0 if there is no such job. */
+static int firstqueued(void) {
+  int first = 0;
+  for (int j = BG; j < njobmax; j++) {
+    if (jobs[j].state != QUEUED || jobs[j].nafter > 0)
+      continue;
+    if (!first || jobs[j].serial < jobs[first].serial)
+      first = j;
+  }
+  return first;
+}
+
+int queuedjobs(void) {
+  int n = 0;
+  for (int j = BG; j < njobmax; j++)
+    if (jobs[j].state == QUEUED)
+      n++;
+  return n;
+}
+
+/* May a new background job start right away without overtaking queued ones? */
+bool admitjob(void) {
+  return !firstqueued() && sched_admit(runningjobs());
+}
+
+/* Describe jobs that a queued job is still waiting for, e.g. " after %1 %3". */
+static void afterlist(job_t *job, char *buf, size_t size) {
+  int n = 0;
+  buf[0] = '\0';
+  if (job->nafter == 0)
+    return;
+  n += snprintf(buf + n, size - n, " %s", job->afterok ? "afterok" : "after");
+  for (int j = 0; j < njobmax; j++)
+    for (int i = 0; i < job->nafter && n < size; i++)
+      if (jobs[j].pgid != 0 && jobs[j].serial == job->after[i])
+        n += snprintf(buf + n, size - n, " %%%d", j);
+}
+
+/* Translate job specification (i.e. %n) into the job's slot. */
+static int jobspec(const char *spec) {
+  if (spec[0] != '%' || !isdigit(spec[1]))
+    return -1;
+  int j = atoi(spec + 1);
+  if (j < BG || j >= njobmax || jobs[j].pgid == 0)
+    return -1;
+  return j;
+}
+
+/* Hold back a background job till admission control lets it run. If `after`
+ * list of jobs (as %n) is given, the job also waits for them to finish.
+ * Returns job number or -1 if a job on `after` list does not exist. */
+int queuejob(char *cmdline, char **after, bool afterok) {
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  int nafter = 0;
+  for (char **spec = after; spec && *spec; spec++, nafter++) {
+    if (!string_p(*spec) || jobspec(*spec) < 0) {
+      if (string_p(*spec))
+        msg("after: job not found: %s\n", *spec);
+      else
+        msg("usage: command & after|afterok %%n ...\n");
+      Sigprocmask(SIG_SETMASK, &mask, NULL);
+      return -1;
+    }
+  }
+
+  int j = allocjob();
+  job_t *job = &jobs[j];
+  job->pgid = -1;
+  job->state = QUEUED;
+  job->proc = NULL;
+  job->nproc = 0;
+  job->cmdline = cmdline;
+  job->serial = ++lastserial;
+  job->after = nafter ? malloc(sizeof(unsigned long) * nafter) : NULL;
+  job->nafter = 0;
+  job->afterok = afterok;
+  job->journal.nevents = 0;
+  record(&job->journal, EV_QUEUED, 0, 0);
+
+  /* Display command line without trailing ampersand. */
+  size_t n = strlen(cmdline);
+  while (n > 0 && (isspace(cmdline[n - 1]) || cmdline[n - 1] == '&'))
+    n--;
+  job->command = strndup(cmdline, n);
+
+  for (int i = 0; i < nafter; i++) {
+    job_t *prev = &jobs[jobspec(after[i])];
+    if (prev->state != FINISHED) {
+      job->after[job->nafter++] = prev->serial;
+    } else if (job->afterok && (prev->nproc == 0 || exitcode(prev) != 0)) {
+      job->state = FINISHED;
+      break;
+    }
+  }
+
+  if (job->state == QUEUED) {
+    char deps[MAXLINE];
+    afterlist(job, deps, sizeof(deps));
+    safe_log("[%d] queued '%s'%s\n", j, job->command, deps);
+  }
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  return j;
+}
+
+/* Take the oldest job out of the queue if admission control permits. Returns
+ * the job's number, which is reserved for it until it is started, and passes
+ * the ownership of its command line to the caller. Returns 0 otherwise. */
+int dequeuejob(char **cmdlinep) {
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  int j = firstqueued();
+  if (j && sched_admit(runningjobs())) {
+    job_t *job = &jobs[j];
+    *cmdlinep = job->cmdline;
+    job->cmdline = NULL;
+    job->state = FINISHED;
+    /* Job goes on under the same number, so it is not archived and its
+     * journal is carried over to the job started from the command line. */
+    job->pgid = 0;
+    deljob(job);
+    reserved = j;
+  } else {
+    j = 0;
+  }
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  return j;
+}
+
+/* Give up the number of a dequeued job that could not be started. */
+void unreservejob(void) {
+  reserved = 0;
+}
+
 char *jobcmd(int j) {
   assert(j < njobmax);
   job_t *job = &jobs[j];
@@ -163,17 +490,18 @@ char *jobcmd(int j) {
  * then move the job to foreground and start monitoring it. */
 bool resumejob(int j, int bg, sigset_t *mask) {
   if (j < 0) {
-    for (j = njobmax - 1; j > 0 && jobs[j].state == FINISHED; j--)
-      continue;
+    for (j = njobmax - 1; j > 0; j--)
+      if (jobs[j].state != FINISHED && jobs[j].state != QUEUED)
+        break;
   }
 
-  if (j >= njobmax || jobs[j].state == FINISHED)
+  if (j >= njobmax || jobs[j].state == FINISHED || jobs[j].state == QUEUED)
     return false;
 
     /* TODO: Continue stopped job. Possibly move job to foreground slot. */
 #ifdef STUDENT
 
-  safe_printf("[%d] continue '%s'\n", j, jobs[j].command);
+  safe_log("[%d] continue '%s'\n", j, jobs[j].command);
   if (bg) {
     jobs[j].state = RUNNING;
     for (int i = 0; i < jobs[j].nproc; i++)
@@ -184,14 +512,16 @@ bool resumejob(int j, int bg, sigset_t *mask) {
       Tcgetattr(tty_fd, &jobs[FG].tmodes);
       int nj = addjob(0, true);
       movejob(0, nj);
+      record(&jobs[nj].journal, EV_BACKGROUND, 0, 0);
       Kill(-jobs[nj].pgid, SIGSTOP);
     }
     movejob(j, FG);
     deljob(&jobs[j]);
+    record(&jobs[FG].journal, EV_FOREGROUND, 0, 0);
     jobs[FG].state = RUNNING;
     for (int i = 0; i < jobs[j].nproc; i++)
       jobs[FG].proc[i].state = RUNNING;
-    Tcsetpgrp(tty_fd, jobs[FG].pgid);
+    setfgpgrp(jobs[FG].pgid);
     Tcsetattr(tty_fd, TCSADRAIN, &jobs[FG].tmodes);
     Kill(-jobs[FG].pgid, SIGCONT);
     monitorjob(mask);
@@ -208,6 +538,13 @@ bool killjob(int j) {
     return false;
   debug("[%d] killing '%s'\n", j, jobs[j].command);
 
+  /* Job that has not been started yet is simply cancelled. */
+  if (jobs[j].state == QUEUED) {
+    jobs[j].state = FINISHED;
+    release(&jobs[j]);
+    return true;
+  }
+
   /* TODO: I love the smell of napalm in the morning. */
 #ifdef STUDENT
   Kill(-jobs[j].pgid, SIGTERM);
@@ -217,8 +554,72 @@ bool killjob(int j) {
   return true;
 }
 
-/* Report state of requested background jobs. Clean up finished jobs. */
-void watchjobs(int which) {
+/* Sum up resources used by processes of a job. */
+void sumusage(proc_t *proc, int nproc, usage_t *total) {
+  memset(total, 0, sizeof(usage_t));
+  for (int i = 0; i < nproc; i++) {
+    usage_t *u = &proc[i].usage;
+    timeradd(&total->utime, &u->utime, &total->utime);
+    timeradd(&total->stime, &u->stime, &total->stime);
+    total->maxrss = max(total->maxrss, u->maxrss);
+    total->nvcsw += u->nvcsw;
+    total->nivcsw += u->nivcsw;
+    total->rchar += u->rchar;
+    total->wchar += u->wchar;
+  }
+}
+
+/* Print a number of bytes with a binary unit suffix. */
+static char *bytestr(char *buf, size_t size, double n) {
+  static const char units[] = "BKMGT";
+  int i = 0;
+  for (; n >= 1024 && units[i + 1]; i++)
+    n /= 1024;
+  snprintf(buf, size, i ? "%.1f%c" : "%.0f%c", n, units[i]);
+  return buf;
+}
+
+/* Describe resource usage in a form that can be appended to a job notice. */
+static void usagestr(usage_t *u, char *buf, size_t size) {
+  char rss[16], rd[16], wr[16];
+  snprintf(buf, size,
+           " (user %ld.%03lds, sys %ld.%03lds, maxrss %s, ctxsw %ld/%ld, "
+           "read %s, written %s)",
+           (long)u->utime.tv_sec, (long)u->utime.tv_usec / 1000,
+           (long)u->stime.tv_sec, (long)u->stime.tv_usec / 1000,
+           bytestr(rss, sizeof(rss), u->maxrss * 1024.0), u->nvcsw, u->nivcsw,
+           bytestr(rd, sizeof(rd), u->rchar), bytestr(wr, sizeof(wr), u->wchar));
+}
+
+/* Report state of each process of a job, used by `jobs -l`. */
+static void watchprocs(rio_writer_t *out, job_t *job) {
+  char usage[MAXLINE];
+  for (int i = 0; i < job->nproc; i++) {
+    proc_t *proc = &job->proc[i];
+    int wstatus = proc->exitcode;
+    if (proc->state == RUNNING)
+      rio_printfb(out, "    %d running\n", proc->pid);
+    else if (proc->state == STOPPED)
+      rio_printfb(out, "    %d suspended\n", proc->pid);
+    else {
+      usagestr(&proc->usage, usage, sizeof(usage));
+      if (WIFEXITED(wstatus))
+        rio_printfb(out, "    %d exited, status=%d%s\n", proc->pid,
+                    WEXITSTATUS(wstatus), usage);
+      if (WIFSIGNALED(wstatus))
+        rio_printfb(out, "    %d killed by signal %d%s\n", proc->pid,
+                    WTERMSIG(wstatus), usage);
+    }
+  }
+}
+
+/* Report state of requested background jobs. Clean up finished jobs.
+ * If `verbose` is set list processes of each job as well. */
+void watchjobs(int which, bool verbose) {
+  /* Notices are gathered and written out at once. */
+  rio_writer_t out;
+  rio_writeinitb(&out, STDERR_FILENO);
+
   for (int j = BG; j < njobmax; j++) {
     if (jobs[j].pgid == 0)
       continue;
@@ -226,25 +627,40 @@ void watchjobs(int which) {
       /* TODO: Report job number, state, command and exit code or signal. */
 #ifdef STUDENT
     int s = jobs[j].state;
-    int wstatus = jobs[j].proc[jobs[j].nproc - 1].exitcode;
     if (which == ALL || which == s) {
       if (s == RUNNING)
-        safe_printf("[%d] running '%s'\n", j, jobs[j].command);
+        rio_printfb(&out, "[%d] running '%s'\n", j, jobs[j].command);
       else if (s == STOPPED)
-        safe_printf("[%d] suspended '%s'\n", j, jobs[j].command);
-      else if (s == FINISHED) {
+        rio_printfb(&out, "[%d] suspended '%s'\n", j, jobs[j].command);
+      else if (s == QUEUED) {
+        char deps[MAXLINE];
+        afterlist(&jobs[j], deps, sizeof(deps));
+        rio_printfb(&out, "[%d] queued '%s'%s\n", j, jobs[j].command, deps);
+      } else if (s == FINISHED && jobs[j].nproc == 0) {
+        rio_printfb(&out, "[%d] cancelled '%s'\n", j, jobs[j].command);
+      } else if (s == FINISHED) {
+        int wstatus = exitcode(&jobs[j]);
+        char usage[MAXLINE];
+        usage_t total;
+        sumusage(jobs[j].proc, jobs[j].nproc, &total);
+        usagestr(&total, usage, sizeof(usage));
         if (WIFEXITED(wstatus))
-          safe_printf("[%d] exited '%s', status=%d\n", j, jobs[j].command,
-                      WEXITSTATUS(wstatus));
+          rio_printfb(&out, "[%d] exited '%s', status=%d%s\n", j,
+                      jobs[j].command, WEXITSTATUS(wstatus), usage);
         if (WIFSIGNALED(wstatus))
-          safe_printf("[%d] killed '%s' by signal %d\n", j, jobs[j].command,
-                      WTERMSIG(wstatus));
-        deljob(&jobs[j]);
+          rio_printfb(&out, "[%d] killed '%s' by signal %d%s\n", j,
+                      jobs[j].command, WTERMSIG(wstatus), usage);
       }
+      if (verbose)
+        watchprocs(&out, &jobs[j]);
+      if (s == FINISHED)
+        deljob(&jobs[j]);
     }
     (void)deljob;
 #endif /* !STUDENT */
   }
+
+  rio_flushb(&out);
 }
 
 /* Monitor job execution. If it gets stopped move it to background.
@@ -252,21 +668,33 @@ void watchjobs(int which) {
 int monitorjob(sigset_t *mask) {
   int exitcode = 0, state;
 
+  /* Notices must be seen before the job takes over the terminal. */
+  safe_logflush(STDERR_FILENO);
+
   /* TODO: Following code requires use of Tcsetpgrp of tty_fd. */
 #ifdef STUDENT
-  Tcsetpgrp(tty_fd, jobs[0].pgid);
+  int j = FG;
+  setfgpgrp(jobs[0].pgid);
+  record(&jobs[0].journal, EV_TERMINAL, jobs[0].pgid, 0);
   do {
     Sigsuspend(mask);
+    STAT_INC(wakeups);
+    SDT_PROBE3(shell, job__wakeup, FG, jobs[FG].pgid, jobs[FG].state);
+    startjobs();
     state = jobstate(0, &exitcode);
     if (jobs[0].state == STOPPED) {
       Tcgetattr(tty_fd, &jobs[0].tmodes);
-      int j = addjob(0, true);
+      j = addjob(0, true);
       movejob(0, j);
+      record(&jobs[j].journal, EV_BACKGROUND, 0, 0);
       state = jobstate(j, &exitcode);
     }
   } while (jobs[0].state == RUNNING);
 
-  Tcsetpgrp(tty_fd, getpid());
+  setfgpgrp(getpid());
+  /* Job is gone if it has finished, so its journal is in history. */
+  record(state == FINISHED ? lastjournal() : &jobs[j].journal, EV_TERMINAL,
+         getpgrp(), 0);
   Tcsetattr(tty_fd, TCSADRAIN, &shell_tmodes);
   Sigprocmask(SIG_SETMASK, mask, NULL);
 
@@ -278,6 +706,272 @@ int monitorjob(sigset_t *mask) {
   return exitcode;
 }
 
+/* Convert wait status into exit status as seen by the user. */
+static int exitstatus(int wstatus) {
+  if (WIFSIGNALED(wstatus))
+    return 128 + WTERMSIG(wstatus);
+  return WEXITSTATUS(wstatus);
+}
+
+/* Returns exit status of a job (or its process, if `pid` is not 0) that has
+ * finished or -1 if it's still alive. Cancelled jobs finish with status 127. */
+static int waitstatus(unsigned long serial, pid_t pid) {
+  for (int j = 0; j < njobmax; j++) {
+    job_t *job = &jobs[j];
+    if (job->pgid == 0 || job->serial != serial)
+      continue;
+    for (int i = 0; i < job->nproc && pid; i++)
+      if (job->proc[i].pid == pid)
+        return job->proc[i].state == FINISHED
+                 ? exitstatus(job->proc[i].exitcode)
+                 : -1;
+    if (job->state != FINISHED)
+      return -1;
+    return job->nproc ? exitstatus(exitcode(job)) : 127;
+  }
+  return 127;
+}
+
+/* Set `deadline` to `timeout` seconds from now. */
+static void setdeadline(struct timespec *deadline, double timeout) {
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += (time_t)timeout;
+  deadline->tv_nsec += (long)((timeout - (time_t)timeout) * 1e9);
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
+
+/* Store time remaining till `deadline` in `left`.
+ * Returns false if the deadline has passed. */
+static bool timeleft(const struct timespec *deadline, struct timespec *left) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  left->tv_sec = deadline->tv_sec - now.tv_sec;
+  left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+  if (left->tv_nsec < 0) {
+    left->tv_sec--;
+    left->tv_nsec += 1000000000L;
+  }
+  return left->tv_sec >= 0;
+}
+
+/* Start measuring time for a command prefixed with `time` keyword. */
+void timestart(void) {
+  freeprocs(timing.proc, timing.nproc);
+  timing.proc = NULL;
+  timing.nproc = 0;
+  getrusage(RUSAGE_SELF, &timing.self);
+  clock_gettime(CLOCK_MONOTONIC, &timing.start);
+}
+
+/* Report time taken by a command since timestart(). Processor time is the
+ * sum of what shell itself and all processes of the job have used. Stages of
+ * a pipeline are reported separately. If the command did not create a job,
+ * e.g. it was a builtin, its exit status is taken from `status`. With
+ * `parsable` set the report consists of key=value records. */
+void timereport(int status, bool parsable) {
+  struct timespec now;
+  struct rusage self;
+  usage_t total;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  getrusage(RUSAGE_SELF, &self);
+  sumusage(timing.proc, timing.nproc, &total);
+  timersub(&self.ru_utime, &timing.self.ru_utime, &self.ru_utime);
+  timersub(&self.ru_stime, &timing.self.ru_stime, &self.ru_stime);
+  timeradd(&total.utime, &self.ru_utime, &total.utime);
+  timeradd(&total.stime, &self.ru_stime, &total.stime);
+  if (timing.nproc > 0)
+    status = exitstatus(timing.proc[timing.nproc - 1].exitcode);
+
+  double real = elapsed(&timing.start, &now);
+  if (parsable)
+    msg("time real=%.6f user=%.6f sys=%.6f status=%d\n", real,
+        seconds(total.utime), seconds(total.stime), status);
+  else
+    msg("real %.3fs  user %.3fs  sys %.3fs\n", real, seconds(total.utime),
+        seconds(total.stime));
+
+  for (int i = 0; i < timing.nproc; i++) {
+    proc_t *proc = &timing.proc[i];
+    usage_t *u = &proc->usage;
+    double stage = elapsed(&timing.start, &proc->finished);
+    int code = exitstatus(proc->exitcode);
+    if (parsable) {
+      msg("stage=%d pid=%d real=%.6f user=%.6f sys=%.6f maxrss=%ld "
+          "status=%d\n",
+          i + 1, (int)proc->pid, stage, seconds(u->utime), seconds(u->stime),
+          u->maxrss, code);
+    } else if (timing.nproc > 1) {
+      msg("  %d: real %.3fs  user %.3fs  sys %.3fs  status %d  '%s'\n", i + 1,
+          stage, seconds(u->utime), seconds(u->stime), code, proc->command);
+    }
+  }
+}
+
+/* A counter that was not read spoils a sum it takes part in. */
+static double counted(uint64_t value) {
+  return value == NOTCOUNTED ? NAN : value;
+}
+
+/* Print value of a counter in `perf stat` fashion. Value is NAN if the counter
+ * was opened, but could not be read. */
+static void perfline(const char *name, double value, bool supported, int i) {
+  if (!supported)
+    msg("  %16s      %s\n", "<not supported>", name);
+  else if (isnan(value))
+    msg("  %16s      %s\n", "<not counted>", name);
+  else if (i == 0)
+    msg("  %16.3f msec %s\n", value / 1e6, name);
+  else
+    msg("  %16.0f      %s\n", value, name);
+}
+
+/* Report performance counters of a command run with `perf stat` keyword
+ * since timestart(). Counters are summed over all stages of a pipeline and
+ * then reported for each stage separately. If the kernel did not let a
+ * process open any counters, software ones are estimated from its rusage. */
+void perfreport(void) {
+  struct timespec now;
+  bool supported[NCOUNTERS] = {false}, estimated = false;
+  double total[NCOUNTERS] = {0.0};
+  char *command = NULL;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (int i = 0; i < timing.nproc; i++) {
+    proc_t *proc = &timing.proc[i];
+    usage_t *u = &proc->usage;
+    bool opened = false;
+    for (int k = 0; k < NCOUNTERS; k++)
+      opened |= proc->counted[k];
+    if (!opened) {
+      estimated = true;
+      proc->counter[0] = (seconds(u->utime) + seconds(u->stime)) * 1e9;
+      proc->counter[1] = u->nvcsw + u->nivcsw;
+      proc->counter[3] = u->faults;
+      proc->counted[0] = proc->counted[1] = proc->counted[3] = true;
+    }
+    for (int k = 0; k < NCOUNTERS; k++) {
+      supported[k] |= proc->counted[k];
+      if (proc->counted[k])
+        total[k] += counted(proc->counter[k]);
+    }
+    if (command)
+      strapp(&command, " | ");
+    strapp(&command, proc->command);
+  }
+
+  if (command == NULL)
+    return;
+
+  if (estimated)
+    msg("perf: counters not permitted (perf_event_paranoid=%d), "
+        "estimated from resource usage\n",
+        perf_paranoid());
+  msg("\n Performance counter stats for '%s':\n\n", command);
+  for (int k = 0; k < NCOUNTERS; k++)
+    perfline(counter_name[k], total[k], supported[k], k);
+  if (supported[4] && supported[5] && total[4] > 0)
+    msg("  %16.2f      insn per cycle\n", total[5] / total[4]);
+
+  for (int i = 0; i < timing.nproc && timing.nproc > 1; i++) {
+    proc_t *proc = &timing.proc[i];
+    msg("\n  %d: '%s'\n", i + 1, proc->command);
+    for (int k = 0; k < NCOUNTERS; k++)
+      if (proc->counted[k])
+        perfline(counter_name[k], counted(proc->counter[k]), true, k);
+  }
+
+  msg("\n  %16.9f seconds time elapsed\n\n", elapsed(&timing.start, &now));
+  free(command);
+}
+
+/* Wait for background jobs (%n) or their processes (pid) listed in `argv`,
+ * or for all running and queued jobs if the list is empty. If `any` is set
+ * return as soon as one of them finishes. Give up after `timeout` seconds
+ * unless it's negative. Returns exit status of the last job waited for, 124 on
+ * timeout and 130 if interrupted. Must be called with SIGCHLD blocked. */
+int waitjobs(char **argv, bool any, double timeout) {
+  struct {
+    unsigned long serial;
+    pid_t pid;
+  } *target = NULL;
+  int ntargets = 0, status = 0;
+
+  for (; *argv; argv++, ntargets++) {
+    target = realloc(target, sizeof(*target) * (ntargets + 1));
+    int j = jobspec(*argv);
+    pid_t pid = isdigit(**argv) ? atoi(*argv) : 0;
+    for (int k = BG; pid && k < njobmax && j < 0; k++)
+      for (int i = 0; i < jobs[k].nproc; i++)
+        if (jobs[k].proc[i].pid == pid)
+          j = k;
+    if (j < 0) {
+      msg("wait: no such job: %s\n", *argv);
+      free(target);
+      return 127;
+    }
+    target[ntargets].serial = jobs[j].serial;
+    target[ntargets].pid = pid;
+  }
+
+  if (ntargets == 0) {
+    for (int j = BG; j < njobmax; j++) {
+      if (jobs[j].state != RUNNING && jobs[j].state != QUEUED)
+        continue;
+      target = realloc(target, sizeof(*target) * (ntargets + 1));
+      target[ntargets].serial = jobs[j].serial;
+      target[ntargets++].pid = 0;
+    }
+  }
+
+  struct timespec deadline, left;
+  setdeadline(&deadline, timeout);
+
+  for (;;) {
+    startjobs();
+
+    int pending = 0, done = -1;
+    for (int i = 0; i < ntargets; i++) {
+      int s = waitstatus(target[i].serial, target[i].pid);
+      if (s < 0)
+        pending++;
+      else if (done < 0 || !any)
+        done = s;
+    }
+
+    if (pending == 0 || (any && done >= 0)) {
+      status = max(done, 0);
+      break;
+    }
+
+    /* Wake up for SIGCHLD. While jobs are queued admission control
+     * has to be consulted every now and then. */
+    struct timespec tick = {.tv_sec = 1}, *tsp = queuedjobs() ? &tick : NULL;
+    if (timeout >= 0) {
+      if (!timeleft(&deadline, &left)) {
+        status = 124;
+        break;
+      }
+      if (tsp == NULL || left.tv_sec < tick.tv_sec)
+        tick = left, tsp = &tick;
+    }
+
+    if (sigtimedwait(&sigchld_mask, NULL, tsp) == SIGCHLD) {
+      sigchld_handler(SIGCHLD);
+    } else if (errno == EINTR) {
+      status = 128 + SIGINT;
+      break;
+    }
+  }
+
+  free(target);
+  return status;
+}
+
 /* Called just at the beginning of shell's life. */
 void initjobs(void) {
   struct sigaction act = {
@@ -300,7 +994,7 @@ void initjobs(void) {
   fcntl(tty_fd, F_SETFD, FD_CLOEXEC);
 
   /* Take control of the terminal. */
-  Tcsetpgrp(tty_fd, getpgrp());
+  setfgpgrp(getpgrp());
 
   /* Save default terminal attributes for the shell. */
   Tcgetattr(tty_fd, &shell_tmodes);
@@ -313,15 +1007,39 @@ void shutdownjobs(void) {
 
   /* TODO: Kill remaining jobs and wait for them to finish. */
 #ifdef STUDENT
-  for (int i = 0; i < njobmax; i++) {
-    if (jobs[i].pgid > 0 && jobs[i].state != FINISHED) {
+  /* Signal all jobs up front and let the reaper collect them as they go.
+   * Jobs that survive the grace period are killed without mercy. */
+  for (int i = 0; i < njobmax; i++)
+    if (jobs[i].pgid != 0)
       killjob(i);
-      Sigsuspend(&mask);
+
+  const char *grace = getenv("SHUTDOWN_GRACE");
+  struct timespec deadline, left;
+  setdeadline(&deadline, grace ? atof(grace) : SHUTDOWN_GRACE);
+  bool escalated = false;
+
+  for (;;) {
+    int alive = 0;
+    for (int i = 0; i < njobmax; i++)
+      if (jobs[i].pgid > 0 && jobs[i].state != FINISHED)
+        alive++;
+    if (alive == 0)
+      break;
+    if (!escalated && !timeleft(&deadline, &left)) {
+      for (int i = 0; i < njobmax; i++) {
+        if (jobs[i].pgid > 0 && jobs[i].state != FINISHED) {
+          debug("[%d] killing '%s' with SIGKILL\n", i, jobs[i].command);
+          Kill(-jobs[i].pgid, SIGKILL);
+        }
+      }
+      escalated = true;
     }
+    if (sigtimedwait(&sigchld_mask, NULL, escalated ? NULL : &left) == SIGCHLD)
+      sigchld_handler(SIGCHLD);
   }
 #endif /* !STUDENT */
 
-  watchjobs(FINISHED);
+  watchjobs(FINISHED, false);
 
   Sigprocmask(SIG_SETMASK, &mask, NULL);
 
@@ -330,5 +1048,6 @@ void shutdownjobs(void) {
 
 /* Sets foreground process group to `pgid`. */
 void setfgpgrp(pid_t pgid) {
+  SDT_PROBE1(shell, tty__handoff, pgid);
   Tcsetpgrp(tty_fd, pgid);
 }
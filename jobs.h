@@ -0,0 +1,99 @@
+#ifndef _JOBS_H_
+#define _JOBS_H_
+
+/* Job table internals shared by modules that inspect running jobs. */
+
+#include "shell.h"
+
+/* Resources used by a process, collected when it finishes. */
+typedef struct usage {
+  struct timeval utime; /* user CPU time */
+  struct timeval stime; /* system CPU time */
+  long maxrss;          /* maximum resident set size in kilobytes */
+  long nvcsw;           /* voluntary context switches */
+  long nivcsw;          /* involuntary context switches */
+  long faults;          /* minor and major page faults */
+  unsigned long rchar;  /* bytes read with read(2) and alike */
+  unsigned long wchar;  /* bytes written with write(2) and alike */
+} usage_t;
+
+/* Live statistics of a process sampled from /proc. Files are kept open
+ * between samples, so the kernel does not have to look up the process
+ * every time. */
+typedef struct sample {
+  int statfd;               /* /proc/PID/stat, -1 if not opened yet */
+  int statmfd;              /* /proc/PID/statm, -1 if not opened yet */
+  char state;               /* R, S, D, T, Z etc. as reported by kernel */
+  unsigned long long ticks; /* user and system time in clock ticks */
+  struct timespec when;     /* when the sample was taken */
+  double cpu;               /* CPU usage since previous sample in percent */
+  long rss;                 /* resident set size in kilobytes */
+} sample_t;
+
+typedef struct proc {
+  pid_t pid;                /* process identifier */
+  int state;                /* RUNNING or STOPPED or FINISHED */
+  int exitcode;             /* -1 if exit status not yet received */
+  char *command;            /* textual representation of the stage */
+  usage_t usage;            /* valid once the process has finished */
+  struct timespec started;  /* when the process was added to its job */
+  struct timespec finished; /* when the reaper noticed termination */
+  int perf[NCOUNTERS];      /* performance counters, -1 if not opened */
+  bool counted[NCOUNTERS];  /* counter was opened */
+  uint64_t counter[NCOUNTERS]; /* final values of performance counters */
+  sample_t sample;          /* most recent sample taken by `jobtop` */
+} proc_t;
+
+/* Kinds of events recorded in a job journal. */
+enum {
+  EV_QUEUED,     /* held back by admission control */
+  EV_CREATED,    /* process group created */
+  EV_FORKED,     /* process started */
+  EV_STOPPED,    /* process stopped */
+  EV_CONTINUED,  /* process continued */
+  EV_FOREGROUND, /* job moved to foreground */
+  EV_BACKGROUND, /* job moved to background */
+  EV_TERMINAL,   /* terminal handed over to process group `pid` */
+  EV_EXITED,     /* process exited or got killed */
+};
+
+typedef struct event {
+  struct timespec when; /* CLOCK_MONOTONIC */
+  pid_t pid;            /* process the event concerns */
+  short type;           /* one of EV_* */
+  int status;           /* wait status for EV_EXITED */
+} event_t;
+
+/* Fixed-size ring of most recent events of a job. */
+#define NEVENTS 32
+
+typedef struct journal {
+  event_t event[NEVENTS];
+  unsigned nevents; /* events recorded so far, may exceed NEVENTS */
+} journal_t;
+
+typedef struct job {
+  pid_t pgid;            /* 0 if slot is free, -1 if job is queued */
+  proc_t *proc;          /* array of processes running in as a job */
+  struct termios tmodes; /* saved terminal modes */
+  int nproc;             /* number of processes */
+  int state;             /* changes when live processes have same state */
+  char *command;         /* textual representation of command line */
+  char *cmdline;         /* command line to start a queued job with */
+  unsigned long serial;  /* unique job identifier, also order of arrival */
+  unsigned long *after;  /* serials of jobs this job waits for */
+  int nafter;            /* number of jobs this job still waits for */
+  bool afterok;          /* cancel the job if any of those jobs fails */
+  journal_t journal;     /* state transitions of the job */
+} job_t;
+
+extern job_t *jobs;  /* array of all jobs, slot FG is the foreground job */
+extern int njobmax;  /* number of slots in jobs array */
+
+void sumusage(proc_t *proc, int nproc, usage_t *total);
+void sampleproc(proc_t *proc, sample_t *s, const struct timespec *now);
+void record(journal_t *journal, int type, pid_t pid, int status);
+void archive(job_t *job, int j);
+journal_t *lastjournal(void);
+
+#endif /* !_JOBS_H_ */
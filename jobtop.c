@@ -0,0 +1,243 @@
+#include "jobs.h"
+#include "terminal.h"
+#include <stdarg.h>
+#include <sys/ioctl.h>
+
+/*
+ * Live view of background jobs:
+ *
+ *   jobtop [-d secs] [-n count] [-s cpu|rss]
+ *
+ * Every `secs` seconds (1 by default) processes of all jobs are sampled and
+ * the screen is redrawn. Jobs are sorted by CPU usage or resident set size,
+ * and processes of each job are listed below it in pipeline order. Press 'q'
+ * or ^C to quit, 'c' or 'm' to sort by CPU or memory. With `-n` only `count`
+ * screens are drawn.
+ *
+ * /proc/PID/stat and /proc/PID/statm of each process are opened once and then
+ * reread with pread, which spares the kernel path lookups and process
+ * iteration. Descriptors are kept only while they occupy no more than half of
+ * the descriptor table, beyond that files are reopened for each sample.
+ */
+
+typedef struct {
+  int job;    /* index into jobs array */
+  double cpu; /* sum of CPU usage of all processes */
+  long rss;   /* sum of resident set sizes */
+} row_t;
+
+static bool by_rss = false; /* sort order */
+
+/* Open a file in /proc directory of given process. */
+static int procopen(pid_t pid, const char *name, bool *keepp) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct rlimit rl;
+  *keepp = fd >= 0 && !getrlimit(RLIMIT_NOFILE, &rl) &&
+           (rl.rlim_cur == RLIM_INFINITY || (rlim_t)fd < rl.rlim_cur / 2);
+  return fd;
+}
+
+/* Read contents of /proc file through descriptor `*fdp`, opening the file if
+ * there's no such descriptor yet. Returns false if the process is gone. */
+static bool procread(pid_t pid, const char *name, int *fdp, char *buf,
+                     size_t size) {
+  bool keep = true;
+  int fd = *fdp >= 0 ? *fdp : procopen(pid, name, &keep);
+  if (fd < 0)
+    return false;
+  ssize_t n = pread(fd, buf, size - 1, 0);
+  if (keep)
+    *fdp = fd;
+  else
+    close(fd);
+  if (n <= 0)
+    return false;
+  buf[n] = '\0';
+  return true;
+}
+
+/* Sample CPU usage and resident set size of a live process into `s`, which
+ * holds the previous sample taken by the same observer. */
+void sampleproc(proc_t *proc, sample_t *s, const struct timespec *now) {
+  char buf[1024];
+
+  if (proc->state == FINISHED ||
+      !procread(proc->pid, "stat", &s->statfd, buf, sizeof(buf))) {
+    s->state = 'X';
+    s->cpu = 0.0;
+    return;
+  }
+
+  /* Command name may contain spaces and parentheses, so skip past the last
+   * closing parenthesis. Then come state (field 3), ..., utime (field 14) and
+   * stime (field 15). */
+  char *p = strrchr(buf, ')');
+  unsigned long long utime = 0, stime = 0;
+  if (p == NULL || sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                                 "%llu %llu",
+                          &s->state, &utime, &stime) != 3)
+    return;
+
+  unsigned long long ticks = utime + stime;
+  if (s->when.tv_sec) {
+    double dt = (now->tv_sec - s->when.tv_sec) +
+                (now->tv_nsec - s->when.tv_nsec) * 1e-9;
+    if (dt > 0)
+      s->cpu = 100.0 * (ticks - s->ticks) / sysconf(_SC_CLK_TCK) / dt;
+  }
+  s->ticks = ticks;
+  s->when = *now;
+
+  long size, resident;
+  if (procread(proc->pid, "statm", &s->statmfd, buf, sizeof(buf)) &&
+      sscanf(buf, "%ld %ld", &size, &resident) == 2)
+    s->rss = resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int cmprow(const void *a, const void *b) {
+  const row_t *x = a, *y = b;
+  if (by_rss)
+    return (x->rss < y->rss) - (x->rss > y->rss);
+  return (x->cpu < y->cpu) - (x->cpu > y->cpu);
+}
+
+/* Append a line with given graphic rendition to the screen. The line is cut
+ * to the width of the terminal, so it never wraps. */
+static void addline(char **screenp, int cols, const char *sgr,
+                    const char *fmt, ...) {
+  char line[MAXLINE];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (cols > 0 && cols < (int)sizeof(line))
+    line[cols] = '\0';
+  strapp(screenp, sgr);
+  strapp(screenp, line);
+  strapp(screenp, SGR("0") EL(0) "\n");
+}
+
+static char jobchr(job_t *job) {
+  static const char state[] = {
+    [FINISHED] = 'X', [RUNNING] = 'R', [STOPPED] = 'T', [QUEUED] = 'Q'};
+  return state[job->state];
+}
+
+static void draw(double delay) {
+  struct winsize ws = {.ws_row = 24, .ws_col = 80};
+  struct timespec now;
+  row_t *row = NULL;
+  int nrows = 0, nprocs = 0;
+
+  (void)ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (int j = BG; j < njobmax; j++) {
+    job_t *job = &jobs[j];
+    if (job->pgid == 0)
+      continue;
+    row = realloc(row, sizeof(row_t) * (nrows + 1));
+    row_t *r = &row[nrows++];
+    *r = (row_t){.job = j};
+    for (int i = 0; i < job->nproc; i++) {
+      sampleproc(&job->proc[i], &job->proc[i].sample, &now);
+      r->cpu += job->proc[i].sample.cpu;
+      r->rss += job->proc[i].sample.rss;
+    }
+    nprocs += job->nproc;
+  }
+
+  qsort(row, nrows, sizeof(row_t), cmprow);
+
+  char *screen = NULL;
+  int cols = ws.ws_col, lines = ws.ws_row - 1;
+  strapp(&screen, CUP(1, 1));
+  addline(&screen, cols, "",
+          "jobtop: %d jobs, %d processes, every %.1fs, sorted by %s "
+          "('q' quits, 'c'/'m' sort)",
+          nrows, nprocs, delay, by_rss ? "memory" : "CPU");
+  addline(&screen, cols, SGR("7"), "%-6s %7s %-2s %6s %9s  %-*s", "JOB", "PID",
+          "S", "CPU%", "RSS", max(cols - 36, 0), "COMMAND");
+  lines -= 2;
+
+  for (int i = 0; i < nrows && lines > 0; i++) {
+    job_t *job = &jobs[row[i].job];
+    char num[16];
+    snprintf(num, sizeof(num), "[%d]", row[i].job);
+    addline(&screen, cols, SGR("1"), "%-6s %7s %-2c %6.1f %8ldK  %s", num, "",
+            jobchr(job), row[i].cpu, row[i].rss, job->command);
+    lines--;
+    for (int k = 0; k < job->nproc && lines > 0 && job->nproc > 1; k++) {
+      proc_t *proc = &job->proc[k];
+      addline(&screen, cols, "", "%-6s %7d %-2c %6.1f %8ldK    %s", "",
+              (int)proc->pid, proc->sample.state, proc->sample.cpu,
+              proc->sample.rss, proc->command);
+      lines--;
+    }
+  }
+  strapp(&screen, ED(0));
+
+  Write(STDOUT_FILENO, screen, strlen(screen));
+  free(screen);
+  free(row);
+}
+
+int do_jobtop(char **argv) {
+  double delay = 1.0;
+  int count = 0;
+
+  by_rss = false;
+  for (; argv[0]; argv += 2) {
+    if (!strcmp(argv[0], "-d") && argv[1])
+      delay = atof(argv[1]);
+    else if (!strcmp(argv[0], "-n") && argv[1])
+      count = atoi(argv[1]);
+    else if (!strcmp(argv[0], "-s") && argv[1])
+      by_rss = !strcmp(argv[1], "rss");
+    else
+      goto usage;
+  }
+
+  if (delay < 0.1 || count < 0)
+    goto usage;
+
+  /* Wait for a key press at most `delay` seconds (in tenths of a second).
+   * This way neither poll(2) nor a timer is needed. */
+  struct termios tmodes, saved;
+  Tcgetattr(STDIN_FILENO, &saved);
+  tmodes = saved;
+  tmodes.c_lflag &= ~(ICANON | ECHO);
+  tmodes.c_cc[VMIN] = 0;
+  tmodes.c_cc[VTIME] = min((int)(delay * 10), 255);
+  Tcsetattr(STDIN_FILENO, TCSADRAIN, &tmodes);
+
+  Write(STDOUT_FILENO, ED(2), sizeof(ED(2)) - 1);
+
+  for (int n = 1;; n++) {
+    startjobs();
+    draw(delay);
+    if (n == count)
+      break;
+
+    /* Let the reaper run only between screens, so it does not restart the
+     * read timeout over and over when many jobs come and go. */
+    sigset_t mask;
+    char c = 0;
+    Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+    ssize_t r = read(STDIN_FILENO, &c, 1);
+    Sigprocmask(SIG_SETMASK, &mask, NULL);
+    if ((r < 0 && errno == EINTR) || c == 'q')
+      break;
+    if (c == 'c' || c == 'm')
+      by_rss = (c == 'm');
+  }
+
+  Tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+  return 0;
+
+usage:
+  msg("usage: jobtop [-d secs] [-n count] [-s cpu|rss]\n");
+  return 2;
+}
@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 void Close(int fd) {
-  int rc = close(fd);
+  int rc = WRAPSTAT(Close, close(fd));
   if (rc < 0)
     unix_error("Close error");
 }
@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 void Connect(int sockfd, struct sockaddr *serv_addr, int addrlen) {
-  int rc = connect(sockfd, serv_addr, addrlen);
+  int rc = WRAPSTAT(Connect, connect(sockfd, serv_addr, addrlen));
   if (rc < 0)
     unix_error("Connect error");
 }
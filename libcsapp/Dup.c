@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 int Dup(int fd) {
-  int rc = dup(fd);
+  int rc = WRAPSTAT(Dup, dup(fd));
   if (rc < 0)
     unix_error("Dup error");
   return rc;
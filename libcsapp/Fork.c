@@ -4,7 +4,7 @@ static unsigned int seed = 0xdeadc0de;
 
 pid_t Fork(void) {
   pid_t pid;
-  if ((pid = fork()) < 0)
+  if ((pid = WRAPSTAT(Fork, fork())) < 0)
     unix_error("Fork error");
   /*
    * Scheduler is not good enough at radomizing time of return from fork().
@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Fstat(int fd, struct stat *statbuf) {
-  if (fstat(fd, statbuf) < 0)
+  if (WRAPSTAT(Fstat, fstat(fd, statbuf)) < 0)
     unix_error("Fstat error");
 }
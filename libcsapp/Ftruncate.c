@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Ftruncate(int fd, off_t length) {
-  if (ftruncate(fd, length) < 0)
+  if (WRAPSTAT(Ftruncate, ftruncate(fd, length)) < 0)
     unix_error("Ftruncate error");
 }
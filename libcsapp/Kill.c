@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Kill(pid_t pid, int sig) {
-  if (kill(pid, sig) < 0)
+  if (WRAPSTAT(Kill, kill(pid, sig)) < 0)
     unix_error("Kill error");
 }
@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Mprotect(void *addr, size_t length, int prot) {
-  if (mprotect(addr, length, prot) < 0)
+  if (WRAPSTAT(Mprotect, mprotect(addr, length, prot)) < 0)
     unix_error("Mprotect error");
 }
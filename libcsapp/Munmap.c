@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Munmap(void *addr, size_t len) {
-  if (munmap(addr, len) < 0)
+  if (WRAPSTAT(Munmap, munmap(addr, len)) < 0)
     unix_error("Munmap error");
 }
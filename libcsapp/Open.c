@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 int Open(const char *pathname, int flags, mode_t mode) {
-  int rc = open(pathname, flags, mode);
+  int rc = WRAPSTAT(Open, open(pathname, flags, mode));
   if (rc < 0)
     unix_error("Open error");
   return rc;
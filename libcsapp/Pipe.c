@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Pipe(int fds[2]) {
-  if (pipe(fds) < 0)
+  if (WRAPSTAT(Pipe, pipe(fds)) < 0)
     unix_error("Pipe error");
 }
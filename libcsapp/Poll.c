@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 int Poll(struct pollfd *fds, nfds_t nfds, int timeout) {
-  int rc = poll(fds, nfds, timeout);
+  int rc = WRAPSTAT(Poll, poll(fds, nfds, timeout));
   if (rc == -1 && errno == EINTR)
     rc = 0;
   if (rc < 0)
@@ -2,7 +2,7 @@
 
 #ifdef LINUX
 void Prctl(int option, long arg) {
-  if (prctl(option, arg) < 0)
+  if (WRAPSTAT(Prctl, prctl(option, arg)) < 0)
     unix_error("Prctl error");
 }
 #endif
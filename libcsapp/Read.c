@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 size_t Read(int fd, void *buf, size_t count) {
-  ssize_t rc = read(fd, buf, count);
+  ssize_t rc = WRAPSTAT(Read, read(fd, buf, count));
   if (rc < 0)
     unix_error("Read error");
   return rc;
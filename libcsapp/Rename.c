@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Rename(const char *oldpath, const char *newpath) {
-  if (rename(oldpath, newpath) < 0)
+  if (WRAPSTAT(Rename, rename(oldpath, newpath)) < 0)
     unix_error("Rename error");
 }
@@ -2,6 +2,6 @@
 
 void Sigaction(int signum, const struct sigaction *act,
                struct sigaction *oldact) {
-  if (sigaction(signum, act, oldact) < 0)
+  if (WRAPSTAT(Sigaction, sigaction(signum, act, oldact)) < 0)
     unix_error("Sigaction error");
 }
@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Sigprocmask(int how, const sigset_t *set, sigset_t *oldset) {
-  if (sigprocmask(how, set, oldset) < 0)
+  if (WRAPSTAT(Sigprocmask, sigprocmask(how, set, oldset)) < 0)
     unix_error("Sigprocmask error");
 }
@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 void Sigsuspend(const sigset_t *mask) {
-  if (sigsuspend(mask) == -1 && errno == EINTR)
+  if (WRAPSTAT(Sigsuspend, sigsuspend(mask)) == -1 && errno == EINTR)
     return;
   unix_error("Sigsuspend error");
 }
@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Socketpair(int domain, int type, int protocol, int sv[2]) {
-  if (socketpair(domain, type, protocol, sv) < 0)
+  if (WRAPSTAT(Socketpair, socketpair(domain, type, protocol, sv)) < 0)
     unix_error("Socketpair error");
 }
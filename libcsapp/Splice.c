@@ -0,0 +1,14 @@
+#include "csapp.h"
+
+#ifdef LINUX
+#include <asm/unistd.h>
+
+size_t Splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+              size_t len, unsigned flags) {
+  ssize_t rc = WRAPSTAT(
+    Splice, syscall(__NR_splice, fd_in, off_in, fd_out, off_out, len, flags));
+  if (rc < 0)
+    unix_error("Splice error");
+  return rc;
+}
+#endif
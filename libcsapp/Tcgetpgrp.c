@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 pid_t Tcgetpgrp(int fd) {
-  int rc = tcgetpgrp(fd);
+  int rc = WRAPSTAT(Tcgetpgrp, tcgetpgrp(fd));
   if (rc < 0)
     unix_error("Tcgetpgrp error");
   return rc;
@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 void Tcsetpgrp(int fd, pid_t pgrp) {
-  int rc = tcsetpgrp(fd, pgrp);
+  int rc = WRAPSTAT(Tcsetpgrp, tcsetpgrp(fd, pgrp));
   if (rc < 0)
     unix_error("Tcsetpgrp error");
 }
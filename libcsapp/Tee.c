@@ -0,0 +1,12 @@
+#include "csapp.h"
+
+#ifdef LINUX
+#include <asm/unistd.h>
+
+size_t Tee(int fd_in, int fd_out, size_t len, unsigned flags) {
+  ssize_t rc = WRAPSTAT(Tee, syscall(__NR_tee, fd_in, fd_out, len, flags));
+  if (rc < 0)
+    unix_error("Tee error");
+  return rc;
+}
+#endif
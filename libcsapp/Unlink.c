@@ -1,6 +1,6 @@
 #include "csapp.h"
 
 void Unlink(const char *pathname) {
-  if (unlink(pathname) < 0)
+  if (WRAPSTAT(Unlink, unlink(pathname)) < 0)
     unix_error("Unlink error");
 }
@@ -1,7 +1,7 @@
 #include "csapp.h"
 
 size_t Write(int fd, const void *buf, size_t count) {
-  ssize_t rc = write(fd, buf, count);
+  ssize_t rc = WRAPSTAT(Write, write(fd, buf, count));
   if (rc < 0)
     unix_error("Write error");
   return rc;
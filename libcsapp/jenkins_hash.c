@@ -225,7 +225,9 @@ acceptable.  Do NOT use for cryptographic purposes.
 -------------------------------------------------------------------------------
 */
 
-uint32_t jenkins_hash(const void *key, size_t length, uint32_t initval) {
+/* Reads of partial words past the end of key are deliberate, see below. */
+__attribute__((no_sanitize_address)) uint32_t
+jenkins_hash(const void *key, size_t length, uint32_t initval) {
   uint32_t a, b, c; /* internal state */
   union {
     const void *ptr;
@@ -438,7 +440,9 @@ uint32_t jenkins_hash(const void *key, size_t length, uint32_t initval) {
  * from hashlittle() on all machines.  hashbig() takes advantage of
  * big-endian byte ordering.
  */
-uint32_t jenkins_hash(const void *key, size_t length, uint32_t initval) {
+/* Reads of partial words past the end of key are deliberate, see below. */
+__attribute__((no_sanitize_address)) uint32_t
+jenkins_hash(const void *key, size_t length, uint32_t initval) {
   uint32_t a, b, c;
   union {
     const void *ptr;
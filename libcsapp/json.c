@@ -0,0 +1,27 @@
+#include "csapp.h"
+
+/* Quote `s` as JSON string literal into `buf` of `size` (at least 3) bytes.
+ * Characters that do not fit are dropped, but the literal is always closed.
+ * Returns `buf`, so the result can be passed straight to printf. */
+char *jsonstr(char *buf, size_t size, const char *s) {
+  size_t n = 0;
+
+  buf[n++] = '"';
+  for (; *s; s++) {
+    char esc[8];
+    int len = 1;
+    if (*s == '"' || *s == '\\')
+      len = snprintf(esc, sizeof(esc), "\\%c", *s);
+    else if ((unsigned char)*s < ' ')
+      len = snprintf(esc, sizeof(esc), "\\u%04x", *s);
+    else
+      esc[0] = *s;
+    if (n + len + 2 > size)
+      break;
+    memcpy(buf + n, esc, len);
+    n += len;
+  }
+  buf[n++] = '"';
+  buf[n] = '\0';
+  return buf;
+}
@@ -1,3 +1,4 @@
+#include <stdarg.h>
 #include "csapp.h"
 #include "rio.h"
 
@@ -61,10 +62,12 @@ void Rio_writen(int fd, const void *usrbuf, size_t n) {
  *    read() if the internal buffer is empty.
  */
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n) {
-  int cnt;
+  ssize_t cnt;
 
   while (rp->rio_cnt <= 0) { /* Refill if buf is empty */
-    rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
+    if (rp->rio_mapsize)
+      return 0; /* Whole file is mapped, so it is EOF */
+    rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, rp->rio_bufsize);
     if (rp->rio_cnt < 0) {
       if (errno != EINTR) /* Interrupted by sig handler return */
         return -1;
@@ -76,7 +79,7 @@ static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n) {
 
   /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
   cnt = n;
-  if (rp->rio_cnt < n)
+  if ((size_t)rp->rio_cnt < n)
     cnt = rp->rio_cnt;
   memcpy(usrbuf, rp->rio_bufptr, cnt);
   rp->rio_bufptr += cnt;
@@ -95,7 +98,68 @@ ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n) {
 void rio_readinitb(rio_t *rp, int fd) {
   rp->rio_fd = fd;
   rp->rio_cnt = 0;
+  rp->rio_buf = rp->rio_fixed;
+  rp->rio_bufsize = RIO_BUFSIZE;
   rp->rio_bufptr = rp->rio_buf;
+  rp->rio_mapsize = 0;
+}
+
+/* rio_readinitb_size - Like rio_readinitb, but with buffer of given size */
+void rio_readinitb_size(rio_t *rp, int fd, size_t bufsize) {
+  rio_readinitb(rp, fd);
+  if (bufsize > RIO_BUFSIZE) {
+    rp->rio_buf = rp->rio_bufptr = Malloc(bufsize);
+    rp->rio_bufsize = bufsize;
+  }
+}
+
+/*
+ * rio_readinitm - Like rio_readinitb, but a regular file larger than default
+ *    buffer is mapped into memory as a whole and read without any copies.
+ *    Other files, or if mapping fails, are read into buffer as usual.
+ *    The mapping is private and writable, so lines returned by rio_readlinev
+ *    may be modified in place as with a buffer. If the file gets truncated
+ *    while it is being read, touching pages past its new end raises SIGBUS.
+ */
+void rio_readinitm(rio_t *rp, int fd) {
+  struct stat st;
+  off_t off;
+  void *map;
+
+  rio_readinitb(rp, fd);
+
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= RIO_BUFSIZE)
+    return;
+  /* Start where the descriptor points to, that must be page aligned. */
+  if ((off = lseek(fd, 0, SEEK_CUR)) < 0 || off >= st.st_size)
+    return;
+  off_t skip = off % sysconf(_SC_PAGESIZE);
+  size_t size = st.st_size - off + skip;
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, off - skip);
+  if (map == MAP_FAILED)
+    return;
+  (void)madvise(map, size, MADV_SEQUENTIAL);
+
+  rp->rio_buf = map;
+  rp->rio_bufsize = rp->rio_mapsize = size;
+  rp->rio_bufptr = rp->rio_buf + skip;
+  rp->rio_cnt = size - skip;
+}
+
+/*
+ * rio_readfreeb - Release buffer that might have been allocated or grown.
+ *    If file was mapped, move descriptor's offset past bytes consumed.
+ */
+void rio_readfreeb(rio_t *rp) {
+  if (rp->rio_mapsize) {
+    /* Descriptor still points where mapping starts, up to page alignment. */
+    off_t off = lseek(rp->rio_fd, 0, SEEK_CUR);
+    off -= off % sysconf(_SC_PAGESIZE);
+    (void)lseek(rp->rio_fd, off + (rp->rio_bufptr - rp->rio_buf), SEEK_SET);
+    (void)munmap(rp->rio_buf, rp->rio_mapsize);
+  } else if (rp->rio_buf != rp->rio_fixed)
+    free(rp->rio_buf);
+  rio_readinitb(rp, -1);
 }
 
 /* rio_readnb - Robustly read n bytes (buffered) */
@@ -117,26 +181,91 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) {
 
 /* rio_readlineb - Robustly read a text line (buffered) */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
-  int n, rc;
-  char c, *bufp = usrbuf;
-
-  for (n = 1; n < maxlen; n++) {
-    if ((rc = rio_read(rp, &c, 1)) == 1) {
-      *bufp++ = c;
-      if (c == '\n') {
-        n++;
+  size_t n = 0;
+  char *bufp = usrbuf;
+
+  /* Copy whole runs of buffered bytes up to a newline, found with memchr. */
+  while (n + 1 < maxlen) {
+    if (rp->rio_cnt <= 0) {
+      char c;
+      ssize_t rc = rio_read(rp, &c, 1); /* Refill and take one byte */
+      if (rc < 0)
+        return -1; /* Error */
+      if (rc == 0)
+        break; /* EOF */
+      bufp[n++] = c;
+      if (c == '\n')
         break;
+      continue;
+    }
+    size_t cnt = min((size_t)rp->rio_cnt, maxlen - 1 - n);
+    char *nl = memchr(rp->rio_bufptr, '\n', cnt);
+    if (nl)
+      cnt = nl - rp->rio_bufptr + 1;
+    memcpy(bufp + n, rp->rio_bufptr, cnt);
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    n += cnt;
+    if (nl)
+      break;
+  }
+
+  if (maxlen > 0)
+    bufp[n] = 0;
+  return n;
+}
+
+/*
+ * rio_readlinev - Find next text line within internal buffer and return its
+ *    length. Nothing is copied unless a line crosses end of buffer: then the
+ *    unread bytes are moved to its beginning, and the buffer is grown if that
+ *    is not enough to hold the line. Returns 0 on EOF.
+ */
+ssize_t rio_readlinev(rio_t *rp, rio_line_t *line) {
+  size_t scanned = 0; /* bytes known not to contain a newline */
+  char *nl;
+
+  while (!(nl = memchr(rp->rio_bufptr + scanned, '\n',
+                       rp->rio_cnt - scanned))) {
+    ssize_t nread = 0; /* mapped file is in buffer as a whole */
+    scanned = rp->rio_cnt;
+
+    if (rp->rio_mapsize == 0) {
+      if (rp->rio_bufptr > rp->rio_buf) {
+        memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+        rp->rio_bufptr = rp->rio_buf;
+      } else if ((size_t)rp->rio_cnt == rp->rio_bufsize) {
+        char *buf = Malloc(rp->rio_bufsize * 2);
+        memcpy(buf, rp->rio_buf, rp->rio_cnt);
+        if (rp->rio_buf != rp->rio_fixed)
+          free(rp->rio_buf);
+        rp->rio_buf = rp->rio_bufptr = buf;
+        rp->rio_bufsize *= 2;
       }
-    } else if (rc == 0) {
-      if (n == 1)
-        return 0; /* EOF, no data read */
-      else
-        break; /* EOF, some data was read */
-    } else
-      return -1; /* Error */
+      nread = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+                   rp->rio_bufsize - rp->rio_cnt);
+    }
+
+    if (nread < 0) {
+      if (errno != EINTR)
+        return -1;
+    } else if (nread == 0) {
+      /* EOF, the last line lacks a newline. */
+      line->ptr = rp->rio_bufptr;
+      line->len = rp->rio_cnt;
+      rp->rio_bufptr += rp->rio_cnt;
+      rp->rio_cnt = 0;
+      return line->len;
+    } else {
+      rp->rio_cnt += nread;
+    }
   }
-  *bufp = 0;
-  return n - 1;
+
+  line->ptr = rp->rio_bufptr;
+  line->len = nl - rp->rio_bufptr + 1;
+  rp->rio_bufptr += line->len;
+  rp->rio_cnt -= line->len;
+  return line->len;
 }
 
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
@@ -145,3 +274,174 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
     unix_error("Rio_readlineb error");
   return rc;
 }
+
+ssize_t Rio_readlinev(rio_t *rp, rio_line_t *line) {
+  ssize_t rc = rio_readlinev(rp, line);
+  if (rc < 0)
+    unix_error("Rio_readlinev error");
+  return rc;
+}
+
+/* rio_writevn - Robustly write all bytes described by iov (unbuffered) */
+ssize_t rio_writevn(int fd, struct iovec *iov, int iovcnt) {
+  size_t total = 0;
+  ssize_t nwritten;
+
+  for (;;) {
+    /* Only empty vectors left would make writev return 0. */
+    while (iovcnt > 0 && iov->iov_len == 0)
+      iov++, iovcnt--;
+    if (iovcnt == 0)
+      break;
+    if ((nwritten = writev(fd, iov, iovcnt)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (nwritten == 0) {
+      errno = EIO;
+      return -1;
+    }
+    total += nwritten;
+    /* Skip vectors written in full and advance into a partially written one. */
+    while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+      nwritten -= iov->iov_len;
+      iov++, iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + nwritten;
+      iov->iov_len -= nwritten;
+    }
+  }
+  return total;
+}
+
+/* rio_writeinitb - Associate a descriptor with a write buffer */
+void rio_writeinitb(rio_writer_t *wp, int fd) {
+  wp->rio_fd = fd;
+  wp->rio_cnt = 0;
+}
+
+/* rio_flushb - Write out contents of internal buffer */
+int rio_flushb(rio_writer_t *wp) {
+  if (wp->rio_cnt == 0)
+    return 0;
+  ssize_t rc = rio_writen(wp->rio_fd, wp->rio_buf, wp->rio_cnt);
+  wp->rio_cnt = 0;
+  return rc < 0 ? -1 : 0;
+}
+
+#define IOVBATCH 64
+
+/*
+ * rio_writevb - Buffered write of a vector. If it does not fit into internal
+ *    buffer, buffered bytes and the vector are written together with writev
+ *    without copying. Returns number of bytes taken from the vector.
+ */
+ssize_t rio_writevb(rio_writer_t *wp, const struct iovec *iov, int iovcnt) {
+  size_t total = 0;
+
+  for (int i = 0; i < iovcnt; i++)
+    total += iov[i].iov_len;
+
+  if (wp->rio_cnt + total <= sizeof(wp->rio_buf)) {
+    for (int i = 0; i < iovcnt; i++) {
+      memcpy(wp->rio_buf + wp->rio_cnt, iov[i].iov_base, iov[i].iov_len);
+      wp->rio_cnt += iov[i].iov_len;
+    }
+    return total;
+  }
+
+  struct iovec vec[IOVBATCH];
+  int n = 0;
+
+  if (wp->rio_cnt > 0)
+    vec[n++] = (struct iovec){wp->rio_buf, wp->rio_cnt};
+  wp->rio_cnt = 0;
+
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0)
+      continue;
+    if (n == IOVBATCH) {
+      if (rio_writevn(wp->rio_fd, vec, n) < 0)
+        return -1;
+      n = 0;
+    }
+    vec[n++] = iov[i];
+  }
+
+  if (rio_writevn(wp->rio_fd, vec, n) < 0)
+    return -1;
+  return total;
+}
+
+/* rio_writeb - Buffered write of n bytes */
+ssize_t rio_writeb(rio_writer_t *wp, const void *usrbuf, size_t n) {
+  struct iovec iov = {(void *)usrbuf, n};
+  return rio_writevb(wp, &iov, 1);
+}
+
+/* rio_vprintfb - Format text directly into internal buffer */
+static ssize_t rio_vprintfb(rio_writer_t *wp, const char *fmt, va_list ap) {
+  size_t left = sizeof(wp->rio_buf) - wp->rio_cnt;
+  va_list aq;
+  int n;
+
+  va_copy(aq, ap);
+  n = vsnprintf(wp->rio_buf + wp->rio_cnt, left, fmt, aq);
+  va_end(aq);
+  if (n < 0)
+    return -1;
+  if ((size_t)n < left) {
+    wp->rio_cnt += n;
+    return n;
+  }
+
+  /* Text did not fit, so make room and format it again. */
+  if (rio_flushb(wp) < 0)
+    return -1;
+
+  if ((size_t)n < sizeof(wp->rio_buf)) {
+    vsnprintf(wp->rio_buf, sizeof(wp->rio_buf), fmt, ap);
+    wp->rio_cnt = n;
+    return n;
+  }
+
+  char *text = Malloc(n + 1);
+  vsnprintf(text, n + 1, fmt, ap);
+  ssize_t rc = rio_writen(wp->rio_fd, text, n);
+  free(text);
+  return rc;
+}
+
+ssize_t rio_printfb(rio_writer_t *wp, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  ssize_t rc = rio_vprintfb(wp, fmt, ap);
+  va_end(ap);
+  return rc;
+}
+
+void Rio_writeb(rio_writer_t *wp, const void *usrbuf, size_t n) {
+  if (rio_writeb(wp, usrbuf, n) < 0)
+    unix_error("Rio_writeb error");
+}
+
+void Rio_writevb(rio_writer_t *wp, const struct iovec *iov, int iovcnt) {
+  if (rio_writevb(wp, iov, iovcnt) < 0)
+    unix_error("Rio_writevb error");
+}
+
+void Rio_printfb(rio_writer_t *wp, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  ssize_t rc = rio_vprintfb(wp, fmt, ap);
+  va_end(ap);
+  if (rc < 0)
+    unix_error("Rio_printfb error");
+}
+
+void Rio_flushb(rio_writer_t *wp) {
+  if (rio_flushb(wp) < 0)
+    unix_error("Rio_flushb error");
+}
@@ -1,34 +1,63 @@
 #include <stdarg.h>
 #include "csapp.h"
+#include "rio.h"
+
+static char const digits[] = "0123456789abcdef";
+
+/* Pairs of decimal digits, so a number is converted two digits at a time. */
+static char const pairs[] = "00010203040506070809"
+                            "10111213141516171819"
+                            "20212223242526272829"
+                            "30313233343536373839"
+                            "40414243444546474849"
+                            "50515253545556575859"
+                            "60616263646566676869"
+                            "70717273747576777879"
+                            "80818283848586878889"
+                            "90919293949596979899";
+
+#define MAXNBUF (sizeof(uintmax_t) * 8 / 3 + 2)
+
+/* Write decimal digits of `num` backwards ending at `end`. */
+static char *format_dec(char *end, uintmax_t num) {
+  char *p = end;
+
+  while (num >= 100) {
+    const char *d = &pairs[(num % 100) * 2];
+    num /= 100;
+    *--p = d[1];
+    *--p = d[0];
+  }
+  if (num >= 10) {
+    *--p = pairs[num * 2 + 1];
+    *--p = pairs[num * 2];
+  } else {
+    *--p = '0' + num;
+  }
+  return p;
+}
 
-/* This is actually used with radix [2..36] */
-static char const digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
-
-#define MAXNBUF (sizeof(intmax_t) * 8 + 1)
-#define LINELEN 512
-
-static char *print_num(char *nbuf, uintmax_t num, int base, int *len_p) {
-  char *p = nbuf;
-
-  *p = '\0';
+/* Write hexadecimal digits of `num` backwards ending at `end`. */
+static char *format_hex(char *end, uintmax_t num) {
+  char *p = end;
   do {
-    *++p = digits[num % base];
-  } while (num /= base);
-
-  *len_p = p - nbuf;
+    *--p = digits[num & 15];
+  } while (num >>= 4);
   return p;
 }
 
-static int safe_vprintf(int fd, const char *fmt, va_list ap) {
-  char line[LINELEN];
+/* Format text into buffer, truncating it if needed. Supports %c, %s, %d, %u
+ * and %x with optional `l` modifier. Returns length of text. */
+static size_t safe_vformat(char *line, size_t size, const char *fmt,
+                           va_list ap) {
   char nbuf[MAXNBUF];
-  int linelen = 0;
+  size_t linelen = 0;
   int stop = 0;
 
 #define PCHAR(c)                                                               \
   {                                                                            \
     int _c = (c);                                                              \
-    if (linelen < MAXLINE)                                                     \
+    if (linelen < size)                                                        \
       line[linelen++] = _c;                                                    \
   }
 
@@ -36,18 +65,18 @@ static int safe_vprintf(int fd, const char *fmt, va_list ap) {
     fmt = "(null)\n";
 
   for (;;) {
-    int neg = 0, lflag = 0;
-    int ch, n, base, sign;
+    int lflag = 0;
+    int ch, n;
     uintmax_t num;
 
     while ((ch = *fmt++) != '%' || stop) {
       if (ch == '\0')
-        goto print;
+        return linelen;
       PCHAR(ch);
     }
 
     const char *percent = fmt - 1;
-    char *p;
+    char *p, *end = nbuf + sizeof(nbuf);
 
   again:
     switch ((ch = *fmt++)) {
@@ -67,43 +96,43 @@ static int safe_vprintf(int fd, const char *fmt, va_list ap) {
         p = va_arg(ap, char *);
         if (p == NULL)
           p = "(null)";
-        n = strlen(p);
-        while (n--)
-          PCHAR(*p++);
+        n = min(strlen(p), size - linelen);
+        memcpy(line + linelen, p, n);
+        linelen += n;
         break;
 
       case 'd':
-        base = 10;
-        sign = 1;
         if (lflag)
           num = va_arg(ap, long);
         else
           num = va_arg(ap, int);
+        if ((intmax_t)num < 0) {
+          PCHAR('-');
+          num = -(intmax_t)num;
+        }
+        p = format_dec(end, num);
         goto number;
 
-      case 'x':
-        base = 16;
-        sign = 0;
+      case 'u':
         if (lflag)
           num = va_arg(ap, unsigned long);
         else
           num = va_arg(ap, unsigned int);
+        p = format_dec(end, num);
         goto number;
 
+      case 'x':
+        if (lflag)
+          num = va_arg(ap, unsigned long);
+        else
+          num = va_arg(ap, unsigned int);
+        PCHAR('0');
+        PCHAR('x');
+        p = format_hex(end, num);
+
       number:
-        if (sign && (intmax_t)num < 0) {
-          neg = 1;
-          num = -(intmax_t)num;
-        }
-        if (neg)
-          PCHAR('-');
-        if (base == 16) {
-          PCHAR('0');
-          PCHAR('x');
-        }
-        p = print_num(nbuf, num, base, &n);
-        while (n--)
-          PCHAR(*p--);
+        while (p < end)
+          PCHAR(*p++);
         break;
 
       default:
@@ -114,8 +143,11 @@ static int safe_vprintf(int fd, const char *fmt, va_list ap) {
     }
   }
 #undef PCHAR
+}
 
-print:
+static int safe_vprintf(int fd, const char *fmt, va_list ap) {
+  char line[MAXLINE];
+  size_t linelen = safe_vformat(line, sizeof(line), fmt, ap);
   return write(fd, line, linelen);
 }
 
@@ -133,3 +165,70 @@ void safe_error(const char *fmt, ...) {
   va_end(ap);
   exit(EXIT_FAILURE);
 }
+
+/*
+ * Log ring: messages are appended by safe_log, also from signal handlers, and
+ * written out by safe_logflush with a single system call. Space is reserved
+ * with compare-and-swap, so a handler may interrupt a message being appended,
+ * but the ring must be drained only where no message is being appended, i.e.
+ * by the main loop. Messages that do not fit are dropped and counted.
+ */
+#define LOGSIZE 65536
+
+static struct {
+  char buf[LOGSIZE];
+  uint64_t head;    /* bytes appended so far */
+  uint64_t tail;    /* bytes written out so far */
+  uint64_t dropped; /* messages that did not fit */
+} logring;
+
+void safe_log(const char *fmt, ...) {
+  char line[MAXLINE];
+  va_list ap;
+
+  va_start(ap, fmt);
+  size_t len = safe_vformat(line, sizeof(line), fmt, ap);
+  va_end(ap);
+
+  uint64_t head = __atomic_load_n(&logring.head, __ATOMIC_RELAXED);
+  do {
+    if (head + len - __atomic_load_n(&logring.tail, __ATOMIC_ACQUIRE) >
+        LOGSIZE) {
+      __atomic_fetch_add(&logring.dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&logring.head, &head, head + len, true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  size_t pos = head % LOGSIZE, first = min(len, LOGSIZE - pos);
+  memcpy(logring.buf + pos, line, first);
+  memcpy(logring.buf, line + first, len - first);
+}
+
+/* Write out messages appended to the log ring. */
+void safe_logflush(int fd) {
+  uint64_t head = __atomic_load_n(&logring.head, __ATOMIC_ACQUIRE);
+  uint64_t tail = logring.tail;
+  uint64_t dropped = __atomic_exchange_n(&logring.dropped, 0, __ATOMIC_RELAXED);
+  struct iovec iov[3];
+  char note[64];
+  int n = 0;
+
+  if (head == tail && dropped == 0)
+    return;
+
+  size_t pos = tail % LOGSIZE, len = head - tail;
+  size_t first = min(len, LOGSIZE - pos);
+  iov[n++] = (struct iovec){logring.buf + pos, first};
+  if (len > first)
+    iov[n++] = (struct iovec){logring.buf, len - first};
+  if (dropped)
+    iov[n++] = (struct iovec){
+      note, snprintf(note, sizeof(note), "(%lu messages dropped)\n",
+                     (unsigned long)dropped)};
+
+  /* Messages that could not be written, e.g. to a hung up terminal, are
+   * dropped. The shell must not die of it. */
+  (void)rio_writevn(fd, iov, n);
+  __atomic_store_n(&logring.tail, head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,253 @@
+#include "csapp.h"
+#include "uring.h"
+
+#ifdef LINUX
+#include <asm/unistd.h>
+#include <linux/io_uring.h>
+
+static const int opcode[] = {
+  [URING_READ] = IORING_OP_READ,
+  [URING_WRITE] = IORING_OP_WRITE,
+  [URING_SPLICE] = IORING_OP_SPLICE,
+  [URING_STATX] = IORING_OP_STATX,
+};
+
+#define NOPS (sizeof(opcode) / sizeof(opcode[0]))
+
+/* Find out which operations are supported by running kernel. */
+static unsigned long probe(int fd) {
+  struct io_uring_probe *p =
+    Calloc(1, sizeof(*p) + 256 * sizeof(struct io_uring_probe_op));
+  unsigned long ops = 0;
+
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, p, 256) == 0)
+    for (unsigned i = 0; i < NOPS; i++)
+      if (opcode[i] <= p->last_op &&
+          (p->ops[opcode[i]].flags & IO_URING_OP_SUPPORTED))
+        ops |= 1UL << i;
+  free(p);
+  return ops;
+}
+
+/*
+ * uring_init - Set up a ring of given size. Returns -1 if requests will not
+ *    be batched, because io_uring is not available or entries is 0.
+ */
+int uring_init(uring_t *ring, unsigned entries) {
+  struct io_uring_params p;
+
+  memset(ring, 0, sizeof(uring_t));
+  ring->fd = -1;
+
+  if (entries == 0)
+    return -1;
+
+  memset(&p, 0, sizeof(p));
+  int fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (fd < 0)
+    return -1;
+
+  /* Reading and writing at current position appeared in Linux 5.6. */
+  if (!(p.features & IORING_FEAT_RW_CUR_POS))
+    goto fail;
+
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_size = ring->cq_size = max(ring->sq_size, ring->cq_size);
+
+  ring->sq_ring = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED)
+      goto fail_sq;
+  }
+
+  ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    goto fail_cq;
+
+  char *sq = ring->sq_ring, *cq = ring->cq_ring;
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = cq + p.cq_off.cqes;
+  ring->entries = p.sq_entries;
+  ring->ops = probe(fd);
+  ring->fd = fd;
+  return 0;
+
+fail_cq:
+  if (ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_size);
+fail_sq:
+  munmap(ring->sq_ring, ring->sq_size);
+fail:
+  close(fd);
+  memset(ring, 0, sizeof(uring_t));
+  ring->fd = -1;
+  return -1;
+}
+
+void uring_free(uring_t *ring) {
+  if (ring->fd < 0)
+    return;
+  munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+  if (ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_size);
+  munmap(ring->sq_ring, ring->sq_size);
+  close(ring->fd);
+  ring->fd = -1;
+}
+
+/* Carry out a request with plain system call. */
+static void perform(uring_req_t *r) {
+  loff_t off = r->off;
+  ssize_t rc;
+
+  do {
+    switch (r->op) {
+      case URING_READ:
+        rc = r->off < 0 ? read(r->fd, r->buf, r->len)
+                        : pread(r->fd, r->buf, r->len, r->off);
+        break;
+      case URING_WRITE:
+        rc = r->off < 0 ? write(r->fd, r->buf, r->len)
+                        : pwrite(r->fd, r->buf, r->len, r->off);
+        break;
+      case URING_SPLICE:
+        rc = syscall(__NR_splice, r->fd, r->off < 0 ? NULL : &off, r->fd_out,
+                     NULL, r->len, 0);
+        break;
+      case URING_STATX:
+        rc = syscall(__NR_statx, r->fd, r->path, 0, STATX_BASIC_STATS, r->buf);
+        break;
+      default:
+        rc = -1;
+        errno = EINVAL;
+    }
+  } while (rc < 0 && errno == EINTR);
+
+  r->result = rc < 0 ? -errno : rc;
+}
+
+static void prepare(uring_t *ring, uring_req_t *r, unsigned i) {
+  unsigned tail = *ring->sq_tail;
+  unsigned idx = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)ring->sqes + idx;
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode[r->op];
+  sqe->user_data = i;
+
+  switch (r->op) {
+    case URING_READ:
+    case URING_WRITE:
+      sqe->fd = r->fd;
+      sqe->addr = (uintptr_t)r->buf;
+      sqe->len = r->len;
+      sqe->off = r->off;
+      break;
+    case URING_SPLICE:
+      sqe->splice_fd_in = r->fd;
+      sqe->splice_off_in = r->off;
+      sqe->fd = r->fd_out;
+      sqe->off = -1;
+      sqe->len = r->len;
+      break;
+    case URING_STATX:
+      sqe->fd = r->fd;
+      sqe->addr = (uintptr_t)r->path;
+      sqe->len = STATX_BASIC_STATS;
+      sqe->off = (uintptr_t)r->buf;
+      break;
+  }
+
+  ring->sq_array[idx] = idx;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Collect completions available in the queue. Returns their number. */
+static int reap(uring_t *ring, uring_req_t *req) {
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  int n = 0;
+
+  for (; head != tail; head++, n++) {
+    struct io_uring_cqe *cqe =
+      (struct io_uring_cqe *)ring->cqes + (head & *ring->cq_mask);
+    req[cqe->user_data].result = cqe->res;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  return n;
+}
+
+/*
+ * uring_run - Carry out requests and wait for all of them to complete.
+ *    Requests may be performed in any order. Their results are stored in
+ *    `result` field. Returns number of requests that failed.
+ */
+int uring_run(uring_t *ring, uring_req_t *req, int nreq) {
+  int submitted = 0, completed = 0, inflight = 0, failed = 0;
+
+  while (completed < nreq) {
+    /* Fill submission queue with requests supported by io_uring. */
+    unsigned queued = 0;
+    while (submitted < nreq &&
+           (ring->fd < 0 || inflight + queued < ring->entries)) {
+      uring_req_t *r = &req[submitted++];
+      if (ring->fd >= 0 && (ring->ops & (1UL << r->op))) {
+        prepare(ring, r, r - req);
+        queued++;
+      } else {
+        perform(r);
+        completed++;
+      }
+    }
+
+    if (queued == 0 && inflight == 0)
+      continue;
+
+    /* Submit queued requests and wait for at least one to complete. */
+    int rc = syscall(__NR_io_uring_enter, ring->fd, queued, 1,
+                     IORING_ENTER_GETEVENTS, NULL, 0);
+    if (rc < 0 && errno != EINTR)
+      unix_error("io_uring_enter error");
+    if (rc > 0)
+      inflight += rc;
+    if (rc < (int)queued) {
+      /* Kernel did not take all entries, so they are still in the queue. */
+      unsigned left = queued - max(rc, 0);
+      while (left > 0) {
+        rc = syscall(__NR_io_uring_enter, ring->fd, left, 0, 0, NULL, 0);
+        if (rc < 0 && errno != EINTR)
+          unix_error("io_uring_enter error");
+        if (rc > 0)
+          left -= rc, inflight += rc;
+      }
+    }
+
+    int n = reap(ring, req);
+    inflight -= n;
+    completed += n;
+  }
+
+  for (int i = 0; i < nreq; i++)
+    if (req[i].result < 0)
+      failed++;
+  return failed;
+}
+#endif /* !LINUX */
@@ -0,0 +1,29 @@
+#include "csapp.h"
+
+#ifdef CSAPP_STATS
+/* Account a call that started at `start`. Async-signal-safe. */
+void wrapstat_account(wrapstat_t *ws, const struct timespec *start,
+                      bool failed) {
+  struct timespec now;
+  int saved = errno;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t ns = (now.tv_sec - start->tv_sec) * 1000000000ULL +
+                (now.tv_nsec - start->tv_nsec);
+  __atomic_fetch_add(&ws->calls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&ws->errors, failed, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&ws->nsecs, ns, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&ws->maxnsecs, __ATOMIC_RELAXED);
+  while (ns > max &&
+         !__atomic_compare_exchange_n(&ws->maxnsecs, &max, ns, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  errno = saved;
+}
+
+void wrapstat_reset(void) {
+  wrapstat_foreach(ws) {
+    ws->calls = ws->errors = 0;
+    ws->nsecs = ws->maxnsecs = 0;
+  }
+}
+#endif
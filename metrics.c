@@ -0,0 +1,261 @@
+#include "jobs.h"
+
+/*
+ * Export of shell and job metrics for textfile collector of node_exporter:
+ *
+ *   metrics [-i secs] path
+ *   metrics off
+ *
+ * Every `secs` seconds (15 by default) metrics are written in Prometheus text
+ * format to a temporary file which then atomically replaces `path`, so the
+ * collector never sees a partial file. Without arguments current settings are
+ * displayed.
+ *
+ * Export never happens while a command line is being evaluated. It is due
+ * when the shell is idle waiting for input or right before it displays a
+ * prompt, and no more often than the interval permits. The file is written
+ * by a short-lived process forked from the shell, which works on its copy of
+ * the job table, so the prompt never waits for /proc or the file system.
+ * Resource totals of a job include usage of its finished processes and CPU
+ * time and resident set size of live ones as sampled from /proc.
+ */
+
+#define METRICS_INTERVAL 15.0
+
+static char *path;                         /* NULL if export is disabled */
+static double interval = METRICS_INTERVAL; /* seconds between exports */
+static struct timespec exported;           /* when metrics were last written */
+
+bool metrics_enabled(void) {
+  return path != NULL;
+}
+
+static void label(FILE *f, const char *s) {
+  for (; *s; s++) {
+    if (*s == '\\' || *s == '"')
+      fprintf(f, "\\%c", *s);
+    else if (*s == '\n')
+      fputs("\\n", f);
+    else
+      fputc(*s, f);
+  }
+}
+
+static void header(FILE *f, const char *name, const char *type,
+                   const char *help) {
+  fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void counter(FILE *f, const char *name, const char *help,
+                    unsigned long value) {
+  header(f, name, "counter", help);
+  fprintf(f, "%s %lu\n", name, value);
+}
+
+/* Buckets of Prometheus histograms are cumulative and measured in seconds. */
+static void histogram(FILE *f, const char *name, const char *help,
+                      hist_t *hist) {
+  unsigned long count = 0;
+  header(f, name, "histogram", help);
+  for (int k = 0; k < NBUCKETS - 1; k++) {
+    count += hist->bucket[k];
+    fprintf(f, "%s_bucket{le=\"%.9g\"} %lu\n", name, (1L << k) * 1e-6, count);
+  }
+  fprintf(f, "%s_bucket{le=\"+Inf\"} %lu\n", name, hist->count);
+  fprintf(f, "%s_sum %.6f\n", name, hist->sum * 1e-6);
+  fprintf(f, "%s_count %lu\n", name, hist->count);
+}
+
+/* Resource totals of a job, in order of `jobmetrics` table. */
+static const struct {
+  const char *name, *type, *help;
+} jobmetrics[] = {
+  {"shell_job_processes", "gauge", "Processes of a job."},
+  {"shell_job_cpu_seconds_total", "counter", "CPU time used by a job."},
+  {"shell_job_resident_bytes", "gauge",
+   "Resident set size of live processes of a job."},
+  {"shell_job_max_resident_bytes", "gauge",
+   "Largest resident set size of finished processes of a job."},
+  {"shell_job_read_bytes_total", "counter",
+   "Bytes read by finished processes of a job."},
+  {"shell_job_written_bytes_total", "counter",
+   "Bytes written by finished processes of a job."},
+};
+
+#define NJOBMETRICS (int)(sizeof(jobmetrics) / sizeof(jobmetrics[0]))
+
+static void jobusage(job_t *job, const struct timespec *now,
+                     double value[NJOBMETRICS]) {
+  usage_t total;
+  long rss = 0;
+
+  sumusage(job->proc, job->nproc, &total);
+  double cpu = total.utime.tv_sec + total.utime.tv_usec * 1e-6 +
+               total.stime.tv_sec + total.stime.tv_usec * 1e-6;
+  for (int i = 0; i < job->nproc; i++) {
+    proc_t *proc = &job->proc[i];
+    if (proc->state == FINISHED)
+      continue;
+    /* Samples of `jobtop` are left alone, so its CPU usage stays right. */
+    sample_t s = {.statfd = -1, .statmfd = -1};
+    sampleproc(proc, &s, now);
+    cpu += (double)s.ticks / sysconf(_SC_CLK_TCK);
+    rss += s.rss;
+    if (s.statfd >= 0)
+      close(s.statfd);
+    if (s.statmfd >= 0)
+      close(s.statmfd);
+  }
+
+  value[0] = job->nproc;
+  value[1] = cpu;
+  value[2] = rss * 1024.0;
+  value[3] = total.maxrss * 1024.0;
+  value[4] = total.rchar;
+  value[5] = total.wchar;
+}
+
+static bool write_metrics(FILE *f) {
+  static const char *state_name[] = {
+    [FINISHED] = "finished", [RUNNING] = "running", [STOPPED] = "stopped",
+    [QUEUED] = "queued"};
+  int count[4] = {0};
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (int j = BG; j < njobmax; j++)
+    if (jobs[j].pgid)
+      count[jobs[j].state]++;
+
+  header(f, "shell_jobs", "gauge", "Background jobs by state.");
+  for (int s = 0; s < 4; s++)
+    fprintf(f, "shell_jobs{state=\"%s\"} %d\n", state_name[s], count[s]);
+
+  counter(f, "shell_forks_total", "Processes started for jobs.",
+          shstat->forks);
+  counter(f, "shell_execve_failures_total",
+          "Commands that could not be executed.", shstat->execfail);
+  counter(f, "shell_sigchld_total", "SIGCHLD deliveries.", shstat->sigchld);
+  counter(f, "shell_lines_total", "Command lines evaluated.", shstat->lines);
+  histogram(f, "shell_spawn_latency_seconds",
+            "Time from reading a command line to starting its job.",
+            &shstat->prompt2exec);
+  histogram(f, "shell_reap_latency_seconds",
+            "Time from starting a process to reaping it.", &shstat->exec2reap);
+
+  double (*value)[NJOBMETRICS] = calloc(njobmax, sizeof(*value));
+  if (value == NULL)
+    return false;
+  for (int j = BG; j < njobmax; j++)
+    if (jobs[j].pgid)
+      jobusage(&jobs[j], &now, value[j]);
+
+  for (int m = 0; m < NJOBMETRICS; m++) {
+    header(f, jobmetrics[m].name, jobmetrics[m].type, jobmetrics[m].help);
+    for (int j = BG; j < njobmax; j++) {
+      if (jobs[j].pgid == 0)
+        continue;
+      fprintf(f, "%s{job=\"%d\",command=\"", jobmetrics[m].name, j);
+      label(f, jobs[j].command ? jobs[j].command : jobs[j].cmdline);
+      fprintf(f, "\"} %.*f\n", m == 1 ? 3 : 0, value[j][m]);
+    }
+  }
+
+  free(value);
+  return true;
+}
+
+/* Write metrics to a temporary file and move it into place. */
+static bool export(void) {
+  char tmp[PATH_MAX];
+  snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    msg("metrics: %s: %s\n", tmp, strerror(errno));
+    return false;
+  }
+
+  FILE *f = fdopen(fd, "w");
+  if (f == NULL) {
+    msg("metrics: %s: %s\n", tmp, strerror(errno));
+    close(fd);
+  } else if (!write_metrics(f)) {
+    msg("metrics: %s\n", strerror(ENOMEM));
+    fclose(f);
+  } else if (fclose(f) != 0) {
+    msg("metrics: %s: %s\n", tmp, strerror(errno));
+  } else {
+    Rename(tmp, path);
+    return true;
+  }
+  (void)unlink(tmp);
+  return false;
+}
+
+/* Write metrics if they are due or `force` is set. Called only while the
+ * shell is idle. The exporter is orphaned right away, so the shell neither
+ * waits for it nor has to reap it. Exporters that overlap use distinct
+ * temporary files and each of them replaces `path` atomically. */
+void metrics_export(bool force) {
+  struct timespec now;
+
+  if (path == NULL)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!force && exported.tv_sec &&
+      usecs(&exported, &now) < (long)(interval * 1e6))
+    return;
+  exported = now;
+
+  /* Job table must not change while it is being copied by fork. */
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (fork() == 0)
+      _exit(export() ? EXIT_SUCCESS : EXIT_FAILURE);
+    _exit(EXIT_SUCCESS);
+  }
+  if (pid < 0)
+    msg("metrics: fork: %s\n", strerror(errno));
+  else
+    (void)waitpid(pid, NULL, 0);
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+int do_metrics(char **argv) {
+  double secs = METRICS_INTERVAL;
+
+  if (argv[0] == NULL) {
+    if (path)
+      msg("metrics -i %g %s\n", interval, path);
+    else
+      msg("metrics off\n");
+    return 0;
+  }
+
+  if (!strcmp(argv[0], "off") && argv[1] == NULL) {
+    free(path);
+    path = NULL;
+    return 0;
+  }
+
+  if (!strcmp(argv[0], "-i") && argv[1]) {
+    secs = atof(argv[1]);
+    argv += 2;
+  }
+
+  if (argv[0] == NULL || argv[1] != NULL || secs <= 0.0) {
+    msg("usage: metrics [-i secs] path | metrics off\n");
+    return 2;
+  }
+
+  free(path);
+  path = strdup(argv[0]);
+  interval = secs;
+  metrics_export(true);
+  return 0;
+}
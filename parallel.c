@@ -0,0 +1,345 @@
+#include "shell.h"
+#include "rio.h"
+
+#ifdef LINUX
+#include <sys/sendfile.h>
+#endif
+
+/*
+ * Data-parallel execution of a filter:
+ *
+ *   parallel --pipe [-j njobs] [-k] [-b blksize] command [args...]
+ *
+ * Standard input is cut into blocks of about `blksize` bytes that always end
+ * on a newline. Each block is fed through a pipe to a fresh instance of the
+ * command and at most `njobs` instances are running at the same time. Output
+ * of every instance is gathered in an anonymous file and copied to standard
+ * output once the instance has finished: in order of input if `-k` was given,
+ * in order of completion otherwise.
+ *
+ * Regular files are mapped into memory only to find record boundaries, while
+ * their byte ranges are spliced to workers. Pipes are peeked with tee(2) and
+ * blocks are moved to workers with splice(2). Other kinds of input (e.g. a
+ * terminal) are read into a buffer and written out.
+ */
+
+#define BLKSIZE (1 << 20)
+
+typedef struct {
+  pid_t pid;  /* 0 if the instance has finished */
+  int output; /* anonymous file with output, -1 if already emitted */
+} block_t;
+
+typedef struct {
+  char **argv;     /* command to run for each block */
+  int njobs;       /* maximum number of instances running at the same time */
+  bool keep_order; /* emit output in order of input */
+  size_t blksize;  /* preferred size of a block */
+  block_t *block;  /* all blocks started so far */
+  int nblocks;     /* number of entries in `block` array */
+  int first;       /* first block that has not been emitted yet */
+  int running;     /* number of instances that are still running */
+  int status;      /* exit status of the first instance that failed */
+} parallel_t;
+
+/* Create a pipe that is not leaked to subprocesses. Try to make it large
+ * enough to hold a whole block, so the feeder rarely waits for a worker. */
+static void openpipe(int fds[2], size_t size) {
+  Pipe(fds);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#ifdef LINUX
+  (void)fcntl(fds[1], F_SETPIPE_SZ, size);
+#endif
+}
+
+/* Anonymous file that holds output of an instance till it can be emitted. */
+static int opentmp(void) {
+  const char *tmpdir = getenv("TMPDIR");
+  char *path = NULL;
+
+  strapp(&path, tmpdir ? tmpdir : "/tmp");
+  strapp(&path, "/parallel.XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0)
+    unix_error("parallel: %s", path);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  Unlink(path);
+  free(path);
+  return fd;
+}
+
+/* Find last occurrence of `c` in `n` bytes starting at `s`. */
+static char *lastchr(char *s, int c, size_t n) {
+  while (n > 0)
+    if (s[--n] == c)
+      return s + n;
+  return NULL;
+}
+
+/* Copy output gathered by an instance to standard output. */
+static void emit(block_t *b) {
+  off_t size = Lseek(b->output, 0, SEEK_END);
+  off_t off = 0;
+
+#ifdef LINUX
+  while (off < size) {
+    ssize_t n = sendfile(STDOUT_FILENO, b->output, &off, size - off);
+    if (n < 0 && errno == EINVAL)
+      break; /* e.g. a terminal does not support splicing */
+    if (n < 0)
+      unix_error("parallel: sendfile");
+  }
+#endif
+
+  if (off < size) {
+    char buf[MAXLINE];
+    Lseek(b->output, off, SEEK_SET);
+    for (size_t n; (n = Read(b->output, buf, sizeof(buf)));)
+      Rio_writen(STDOUT_FILENO, buf, n);
+  }
+
+  Close(b->output);
+  b->output = -1;
+}
+
+/* Wait for instance `pid`, or any if -1, to finish and emit all output that
+ * is ready. */
+static void reap(parallel_t *par, pid_t pid) {
+  int status;
+  pid = Waitpid(pid, &status, 0);
+
+  for (int i = par->first; i < par->nblocks; i++) {
+    block_t *b = &par->block[i];
+    if (b->pid != pid)
+      continue;
+    b->pid = 0;
+    if (status && !par->status)
+      par->status = status;
+    if (!par->keep_order)
+      emit(b);
+    break;
+  }
+
+  par->running--;
+
+  for (; par->first < par->nblocks; par->first++) {
+    block_t *b = &par->block[par->first];
+    if (b->pid)
+      break;
+    if (b->output >= 0)
+      emit(b);
+  }
+}
+
+/* Start an instance of the command for the next block.
+ * Returns a descriptor the block should be written to. */
+static int start(parallel_t *par) {
+  /* With -k output of a finished block stays in its file until all earlier
+   * blocks are emitted. Wait for the oldest one instead of piling up files. */
+  while (par->keep_order && par->nblocks - par->first >= 2 * par->njobs)
+    reap(par, par->block[par->first].pid);
+  if (par->running == par->njobs)
+    reap(par, -1);
+
+  par->block = Realloc(par->block, sizeof(block_t) * (par->nblocks + 1));
+  block_t *b = &par->block[par->nblocks++];
+
+  int fds[2];
+  openpipe(fds, par->blksize);
+  b->output = opentmp();
+
+  if ((b->pid = Fork()) == 0) {
+    Dup2(fds[0], STDIN_FILENO);
+    Dup2(b->output, STDOUT_FILENO);
+    external_command(par->argv);
+  }
+
+  par->running++;
+  Close(fds[0]);
+  return fds[1];
+}
+
+#ifdef LINUX
+/* Move `len` bytes from `in` to `out` without copying them.
+ * Returns false if input ended before that, e.g. file was truncated. */
+static bool transfer(int in, loff_t *offp, int out, size_t len) {
+  while (len > 0) {
+    size_t n = Splice(in, offp, out, NULL, len, SPLICE_F_MOVE);
+    if (n == 0)
+      return false;
+    len -= n;
+  }
+  return true;
+}
+
+/* Input ended earlier than expected: stop splitting it and fail. */
+static void truncated(parallel_t *par) {
+  msg("parallel: input ended unexpectedly\n");
+  if (!par->status)
+    par->status = W_EXITCODE(1, 0);
+}
+
+/* Input is a regular file: map it to find record boundaries and splice
+ * consecutive byte ranges to workers. */
+static void split_file(parallel_t *par, int in, off_t size) {
+  off_t off = Lseek(in, 0, SEEK_CUR);
+  if (off >= size)
+    return;
+
+  char *data = Mmap(NULL, size, PROT_READ, MAP_SHARED, in, 0);
+  Madvise(data, size, MADV_SEQUENTIAL);
+
+  while (off < size) {
+    size_t len = min((off_t)par->blksize, size - off);
+    if (off + len < size) {
+      char *eol = lastchr(data + off, '\n', len);
+      if (eol == NULL)
+        eol = memchr(data + off + len, '\n', size - off - len);
+      len = eol ? (size_t)(eol - (data + off) + 1) : (size_t)(size - off);
+    }
+    int out = start(par);
+    loff_t pos = off;
+    bool done = transfer(in, &pos, out, len);
+    Close(out);
+    if (!done) {
+      truncated(par);
+      break;
+    }
+    off += len;
+  }
+
+  Munmap(data, size);
+}
+
+/* Copy up to `len` bytes waiting in pipe `in` into `buf` without consuming
+ * them. Returns 0 at the end of input. */
+static size_t peek(int in, int scratch[2], char *buf, size_t len) {
+  size_t n = Tee(in, scratch[1], len, 0);
+  for (size_t i = 0; i < n;)
+    i += Read(scratch[0], buf + i, n - i);
+  return n;
+}
+
+/* Input is a pipe: look for record boundaries in data duplicated with tee(2)
+ * and then splice the block from the input pipe straight to a worker. */
+static void split_pipe(parallel_t *par, int in) {
+  size_t blksize = par->blksize;
+  char *buf = Malloc(blksize);
+  int scratch[2];
+
+  openpipe(scratch, blksize);
+  (void)fcntl(in, F_SETPIPE_SZ, blksize);
+
+  size_t n = peek(in, scratch, buf, blksize);
+  while (n > 0) {
+    int out = start(par);
+    size_t size = 0;
+    for (;;) {
+      /* Cut after the last record that fits into the block. Once the block
+       * is full finish the current record as soon as possible. */
+      char *eol =
+        size < blksize ? lastchr(buf, '\n', n) : memchr(buf, '\n', n);
+      size_t len = eol ? (size_t)(eol - buf + 1) : n;
+      if (!transfer(in, NULL, out, len)) {
+        truncated(par);
+        n = 0;
+        break;
+      }
+      size += len;
+      bool full = eol && size >= blksize / 2;
+      size_t want = (full || size >= blksize) ? blksize : blksize - size;
+      n = peek(in, scratch, buf, want);
+      if (full || n == 0)
+        break;
+    }
+    Close(out);
+  }
+
+  Close(scratch[0]);
+  Close(scratch[1]);
+  free(buf);
+}
+#endif
+
+/* Input of any other kind: read it into a buffer, that grows if a record does
+ * not fit, and write out all complete records. */
+static void split_stream(parallel_t *par, int in) {
+  size_t size = par->blksize;
+  char *buf = Malloc(size);
+  size_t n = 0;
+  bool eof = false;
+
+  for (;;) {
+    while (!eof && n < size) {
+      size_t r = Read(in, buf + n, size - n);
+      eof = (r == 0);
+      n += r;
+    }
+    if (n == 0)
+      break;
+
+    char *eol = lastchr(buf, '\n', n);
+    if (eol == NULL && !eof) {
+      size *= 2;
+      buf = Realloc(buf, size);
+      continue;
+    }
+
+    size_t len = (eol && !eof) ? (size_t)(eol - buf + 1) : n;
+    int out = start(par);
+    Rio_writen(out, buf, len);
+    Close(out);
+    memmove(buf, buf + len, n - len);
+    n -= len;
+  }
+
+  free(buf);
+}
+
+int do_parallel(char **argv) {
+  parallel_t par = {.njobs = sysconf(_SC_NPROCESSORS_ONLN), .blksize = BLKSIZE};
+  bool pipe_mode = false;
+
+  for (; *argv && **argv == '-'; argv++) {
+    if (!strcmp(*argv, "--pipe"))
+      pipe_mode = true;
+    else if (!strcmp(*argv, "-k"))
+      par.keep_order = true;
+    else if (!strcmp(*argv, "-j") && argv[1])
+      par.njobs = atoi(*++argv);
+    else if (!strcmp(*argv, "-b") && argv[1])
+      par.blksize = atoi(*++argv);
+    else
+      break;
+  }
+
+  if (!pipe_mode || !*argv || **argv == '-' || par.njobs < 1 ||
+      (ssize_t)par.blksize < 1) {
+    msg("usage: parallel --pipe [-j njobs] [-k] [-b blksize] command ...\n");
+    return 2;
+  }
+
+  par.argv = argv;
+
+  struct stat sb;
+  Fstat(STDIN_FILENO, &sb);
+
+#ifdef LINUX
+  if (S_ISREG(sb.st_mode))
+    split_file(&par, STDIN_FILENO, sb.st_size);
+  else if (S_ISFIFO(sb.st_mode))
+    split_pipe(&par, STDIN_FILENO);
+  else
+#endif
+    split_stream(&par, STDIN_FILENO);
+
+  while (par.running > 0)
+    reap(&par, -1);
+
+  free(par.block);
+
+  if (WIFSIGNALED(par.status))
+    return 128 + WTERMSIG(par.status);
+  return WEXITSTATUS(par.status);
+}
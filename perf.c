@@ -0,0 +1,170 @@
+#include "shell.h"
+
+#ifdef LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Performance counters for jobs started with `perf stat` keyword.
+ *
+ * Every process of the job opens counters on itself right before it calls
+ * execve, so nothing the shell does is counted. Counters are inherited by
+ * descendants and enabled on exec. Their descriptors are passed to the shell
+ * over a socket and read by the reaper when the process terminates.
+ *
+ * Hardware counters are often unavailable (e.g. in virtual machines) and all
+ * of them may be forbidden by kernel.perf_event_paranoid. If kernel profiling
+ * is not permitted counters are restricted to user mode. Counters that cannot
+ * be opened at all are reported as not supported.
+ */
+
+const char *counter_name[NCOUNTERS] = {
+  "task-clock",     "context-switches", "cpu-migrations",
+  "page-faults",    "cycles",           "instructions",
+};
+
+#ifdef LINUX
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} counter_event[NCOUNTERS] = {
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+};
+
+static int perf_event_open(struct perf_event_attr *attr, bool user_only) {
+  attr->exclude_kernel = user_only;
+  attr->exclude_hv = user_only;
+  return syscall(SYS_perf_event_open, attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+#endif
+
+/* Returns value of kernel.perf_event_paranoid or -1 if it's unknown. */
+int perf_paranoid(void) {
+  char buf[16];
+  int fd = open("/proc/sys/kernel/perf_event_paranoid", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return -1;
+  buf[n] = '\0';
+  return atoi(buf);
+}
+
+/* Create a channel to pass counters from a new process to the shell. */
+void perf_prepare(int sock[2]) {
+  Socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sock);
+}
+
+/* Called by a new process before it starts the command. Open counters for
+ * this process and send their descriptors to the shell. */
+void perf_attach(int sock[2]) {
+  int fd[NCOUNTERS], nfds = 0;
+  char opened[NCOUNTERS] = {0};
+
+  Close(sock[0]);
+
+#ifdef LINUX
+  bool user_only = false;
+  for (int i = 0; i < NCOUNTERS; i++) {
+    struct perf_event_attr attr = {
+      .size = sizeof(attr),
+      .type = counter_event[i].type,
+      .config = counter_event[i].config,
+      .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING,
+      .disabled = 1,
+      .inherit = 1,
+      .enable_on_exec = 1,
+    };
+    int n = perf_event_open(&attr, user_only);
+    if (n < 0 && (errno == EACCES || errno == EPERM) && !user_only)
+      n = perf_event_open(&attr, user_only = true);
+    if (n >= 0) {
+      fd[nfds++] = n;
+      opened[i] = 1;
+    }
+  }
+#endif
+
+  /* Tell which counters are present and attach their descriptors. */
+  union {
+    char buf[CMSG_SPACE(sizeof(fd))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = opened, .iov_len = sizeof(opened)};
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  if (nfds > 0) {
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fd, sizeof(int) * nfds);
+  }
+  (void)sendmsg(sock[1], &msg, 0);
+
+  /* Shell holds counters open now. */
+  for (int i = 0; i < nfds; i++)
+    Close(fd[i]);
+  Close(sock[1]);
+}
+
+/* Called by the shell after it started a new process. Receive descriptors of
+ * counters, -1 is stored for counters that could not be opened. */
+void perf_receive(int sock[2], int fd[NCOUNTERS]) {
+  char opened[NCOUNTERS] = {0};
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * NCOUNTERS)];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = opened, .iov_len = sizeof(opened)};
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control.buf,
+    .msg_controllen = sizeof(control.buf),
+  };
+
+  Close(sock[1]);
+
+  ssize_t n;
+  while ((n = recvmsg(sock[0], &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+    ;
+
+  int *received = NULL;
+  struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    received = (int *)CMSG_DATA(cmsg);
+
+  for (int i = 0, k = 0; i < NCOUNTERS; i++)
+    fd[i] = (received && opened[i]) ? received[k++] : -1;
+
+  Close(sock[0]);
+}
+
+/* Read final values of counters and close them. Counters that were not always
+ * running are scaled up, ones that could not be read are left NOTCOUNTED.
+ * Called from the reaper, so it's async-signal-safe. */
+void perf_read(int fd[NCOUNTERS], uint64_t value[NCOUNTERS]) {
+  for (int i = 0; i < NCOUNTERS; i++) {
+    uint64_t buf[3]; /* value, time enabled, time running */
+    if (fd[i] < 0)
+      continue;
+    if (read(fd[i], buf, sizeof(buf)) == sizeof(buf)) {
+      value[i] = buf[0];
+      if (buf[2] > 0 && buf[2] < buf[1])
+        value[i] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+    }
+    close(fd[i]);
+    fd[i] = -1;
+  }
+}
@@ -0,0 +1,265 @@
+#include "csapp.h"
+#include "rio.h"
+#include "benchmark.h"
+
+/*
+ * Benchmark of line readers and writers from rio package:
+ *
+ *   riobench [-n repeats] [file]
+ *
+ * The file, or lines of random length generated in memory if none is given,
+ * is read `repeats` times with each reader: the classic one that takes one
+ * byte at a time, rio_readlineb that copies buffered runs found with memchr,
+ * rio_readlinev that returns views of lines inside of its own buffer, and
+ * the same on a file mapped into memory by rio_readinitm.
+ * Then lines are copied to a temporary file with each writer: rio_writen
+ * called for every line, rio_writeb, and rio_writevb given the line and its
+ * newline as separate vectors. Throughput of each reader and writer is printed
+ * together with number of lines read or written and their checksum, which must
+ * be the same for all of them.
+ */
+
+#define MAXLEN 65536
+
+/* Reader from CS:APP that rio_readlineb used to be. */
+static ssize_t bytewise_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
+  size_t n;
+  ssize_t rc;
+  char c, *bufp = usrbuf;
+
+  for (n = 1; n < maxlen; n++) {
+    if ((rc = rio_readnb(rp, &c, 1)) == 1) {
+      *bufp++ = c;
+      if (c == '\n') {
+        n++;
+        break;
+      }
+    } else if (rc == 0) {
+      if (n == 1)
+        return 0; /* EOF, no data read */
+      break;      /* EOF, some data was read */
+    } else
+      return -1; /* Error */
+  }
+  *bufp = 0;
+  return n - 1;
+}
+
+static void checksum(result_t *res, const char *line, size_t len) {
+  res->count++;
+  for (size_t i = 0; i < len; i++)
+    res->sum = res->sum * 31 + (unsigned char)line[i];
+}
+
+static result_t run_bytewise(int fd) {
+  static char buf[MAXLEN];
+  result_t res = {0, 0};
+  rio_t rio;
+  ssize_t n;
+
+  rio_readinitb(&rio, fd);
+  while ((n = bytewise_readlineb(&rio, buf, sizeof(buf))) > 0)
+    checksum(&res, buf, n);
+  if (n < 0)
+    unix_error("bytewise_readlineb error");
+  return res;
+}
+
+static result_t run_readlineb(int fd) {
+  static char buf[MAXLEN];
+  result_t res = {0, 0};
+  rio_t rio;
+  ssize_t n;
+
+  rio_readinitb(&rio, fd);
+  while ((n = Rio_readlineb(&rio, buf, sizeof(buf))) > 0)
+    checksum(&res, buf, n);
+  return res;
+}
+
+static result_t run_readlinev(int fd) {
+  result_t res = {0, 0};
+  rio_line_t line;
+  rio_t rio;
+
+  rio_readinitb(&rio, fd);
+  while (Rio_readlinev(&rio, &line) > 0)
+    checksum(&res, line.ptr, line.len);
+  rio_readfreeb(&rio);
+  return res;
+}
+
+static result_t run_mapped(int fd) {
+  result_t res = {0, 0};
+  rio_line_t line;
+  rio_t rio;
+
+  rio_readinitm(&rio, fd);
+  while (Rio_readlinev(&rio, &line) > 0)
+    checksum(&res, line.ptr, line.len);
+  rio_readfreeb(&rio);
+  return res;
+}
+
+static struct {
+  const char *name;
+  result_t (*run)(int fd);
+} readers[] = {
+  {"bytewise", run_bytewise},
+  {"readlineb", run_readlineb},
+  {"readlinev", run_readlinev},
+  {"mapped", run_mapped},
+};
+
+#define NREADERS (sizeof(readers) / sizeof(readers[0]))
+
+static void copy_writen(int in, int out) {
+  rio_line_t line;
+  rio_t rio;
+
+  rio_readinitb(&rio, in);
+  while (Rio_readlinev(&rio, &line) > 0)
+    Rio_writen(out, line.ptr, line.len);
+  rio_readfreeb(&rio);
+}
+
+static void copy_writeb(int in, int out) {
+  rio_writer_t w;
+  rio_line_t line;
+  rio_t rio;
+
+  rio_readinitb(&rio, in);
+  rio_writeinitb(&w, out);
+  while (Rio_readlinev(&rio, &line) > 0)
+    Rio_writeb(&w, line.ptr, line.len);
+  Rio_flushb(&w);
+  rio_readfreeb(&rio);
+}
+
+static void copy_writevb(int in, int out) {
+  rio_writer_t w;
+  rio_line_t line;
+  rio_t rio;
+
+  rio_readinitb(&rio, in);
+  rio_writeinitb(&w, out);
+  while (Rio_readlinev(&rio, &line) > 0) {
+    bool nl = line.ptr[line.len - 1] == '\n';
+    struct iovec iov[2] = {{line.ptr, line.len - nl}, {"\n", 1}};
+    Rio_writevb(&w, iov, 1 + nl);
+  }
+  Rio_flushb(&w);
+  rio_readfreeb(&rio);
+}
+
+static struct {
+  const char *name;
+  void (*copy)(int in, int out);
+} writers[] = {
+  {"writen", copy_writen},
+  {"writeb", copy_writeb},
+  {"writevb", copy_writevb},
+};
+
+#define NWRITERS (sizeof(writers) / sizeof(writers[0]))
+
+static int tmpfile_fd(void) {
+  char path[] = "/tmp/riobench.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    unix_error("mkstemp error");
+  Unlink(path);
+  return fd;
+}
+
+/* Fill a temporary file with about 16MiB of lines shorter than MAXLEN. */
+static int generate(void) {
+  int fd = tmpfile_fd();
+
+  char *buf = Malloc(MAXLEN);
+  size_t total = 0;
+  srandom(1);
+  while (total < 16 << 20) {
+    /* Mostly short lines, as in scripts, with a few long ones. */
+    size_t len = random() % 100 == 0 ? random() % (MAXLEN - 1) : random() % 80;
+    for (size_t i = 0; i < len; i++)
+      buf[i] = ' ' + random() % 95;
+    buf[len] = '\n';
+    Rio_writen(fd, buf, len + 1);
+    total += len + 1;
+  }
+  free(buf);
+  return fd;
+}
+
+int main(int argc, char *argv[]) {
+  int repeats = 3, opt, fd;
+  struct stat st;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt == 'n' && (repeats = atoi(optarg)) > 0)
+      continue;
+    goto usage;
+  }
+
+  if (optind == argc)
+    fd = generate();
+  else if (optind == argc - 1)
+    fd = Open(argv[optind], O_RDONLY, 0);
+  else
+    goto usage;
+
+  Fstat(fd, &st);
+
+  result_t first = {0, 0};
+  bool mismatch = false;
+
+  for (size_t i = 0; i < NREADERS; i++) {
+    result_t res = {0, 0};
+    double start = now();
+    for (int r = 0; r < repeats; r++) {
+      Lseek(fd, 0, SEEK_SET);
+      res = readers[i].run(fd);
+    }
+    double elapsed = now() - start;
+    printf("%-10s %10.1f MB/s %10lu lines  checksum %016lx\n", readers[i].name,
+           st.st_size * repeats / elapsed / 1e6, res.count, res.sum);
+    if (i == 0)
+      first = res;
+    else if (res.count != first.count || res.sum != first.sum)
+      mismatch = true;
+    /* Every reader must leave the descriptor at end of file. */
+    if (Lseek(fd, 0, SEEK_CUR) != st.st_size)
+      mismatch = true;
+  }
+
+  for (size_t i = 0; i < NWRITERS; i++) {
+    int out = tmpfile_fd();
+    double start = now();
+    for (int r = 0; r < repeats; r++) {
+      Lseek(fd, 0, SEEK_SET);
+      Lseek(out, 0, SEEK_SET);
+      writers[i].copy(fd, out);
+    }
+    double elapsed = now() - start;
+    Lseek(out, 0, SEEK_SET);
+    result_t res = run_readlinev(out);
+    Close(out);
+    printf("%-10s %10.1f MB/s %10lu lines  checksum %016lx\n", writers[i].name,
+           st.st_size * repeats / elapsed / 1e6, res.count, res.sum);
+    if (res.count != first.count || res.sum != first.sum)
+      mismatch = true;
+  }
+
+  Close(fd);
+
+  if (mismatch) {
+    fprintf(stderr, "riobench: readers and writers do not agree\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+
+usage:
+  fprintf(stderr, "usage: %s [-n repeats] [file]\n", argv[0]);
+  return EXIT_FAILURE;
+}
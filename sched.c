@@ -0,0 +1,101 @@
+#include "shell.h"
+
+/*
+ * Admission control of background jobs. Instead of being started right away
+ * a job is put into a queue if any of following limits has been reached:
+ *  - the number of running background jobs,
+ *  - 1-minute load average as reported by /proc/loadavg,
+ *  - CPU pressure, i.e. share of last 10 seconds in which some runnable tasks
+ *    were waiting for a CPU, as reported by /proc/pressure/cpu.
+ * Queued jobs are started in order of arrival as soon as limits permit.
+ * Load average and pressure react slowly to new jobs, so while any of those
+ * limits is set at most one job is let in per second.
+ */
+
+static int maxjobs = 0;          /* 0 if unlimited */
+static double maxload = 0.0;     /* 0 if load average is ignored */
+static double maxpressure = 0.0; /* 0 if CPU pressure is ignored */
+static struct timespec admitted; /* when last job was let in */
+
+/* Read a value from a kernel statistics file. Returns false on failure,
+ * e.g. if the kernel does not provide such statistics. */
+static bool readstat(const char *path, const char *fmt, double *valp) {
+  char buf[128];
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return false;
+  buf[n] = '\0';
+  return sscanf(buf, fmt, valp) == 1;
+}
+
+bool sched_admit(int running) {
+  double val;
+
+  if (maxjobs > 0 && running >= maxjobs)
+    return false;
+
+  if (maxload > 0.0 || maxpressure > 0.0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed = (now.tv_sec - admitted.tv_sec) * 1000 +
+                   (now.tv_nsec - admitted.tv_nsec) / 1000000;
+    if (admitted.tv_sec && elapsed < 1000)
+      return false;
+    if (maxload > 0.0 && readstat("/proc/loadavg", "%lf", &val) &&
+        val >= maxload)
+      return false;
+    if (maxpressure > 0.0 &&
+        readstat("/proc/pressure/cpu", "some avg10=%lf", &val) &&
+        val >= maxpressure)
+      return false;
+    admitted = now;
+  }
+
+  return true;
+}
+
+/*
+ * Configure admission control of background jobs.
+ * 'sched' - display limits and number of queued jobs
+ * 'sched -j n' - run at most n background jobs at the same time
+ * 'sched -l load' - hold jobs back while load average is at least `load`
+ * 'sched -p pct' - hold jobs back while CPU pressure is at least `pct`
+ * 'sched off' - disable all limits
+ * Setting a limit to 0 disables it.
+ */
+int do_sched(char **argv) {
+  if (argv[0] && !strcmp(argv[0], "off")) {
+    maxjobs = 0;
+    maxload = maxpressure = 0.0;
+    return 0;
+  }
+
+  if (argv[0] == NULL) {
+    msg("sched -j %d -l %.2f -p %.2f (%d queued)\n", maxjobs, maxload,
+        maxpressure, queuedjobs());
+    return 0;
+  }
+
+  for (; argv[0]; argv += 2) {
+    if (argv[1] == NULL)
+      goto usage;
+    if (!strcmp(argv[0], "-j"))
+      maxjobs = atoi(argv[1]);
+    else if (!strcmp(argv[0], "-l"))
+      maxload = atof(argv[1]);
+    else if (!strcmp(argv[0], "-p"))
+      maxpressure = atof(argv[1]);
+    else
+      goto usage;
+  }
+
+  return 0;
+
+usage:
+  msg("usage: sched [-j njobs] [-l load] [-p pressure] | sched off\n");
+  return 1;
+}
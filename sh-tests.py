@@ -3,11 +3,15 @@
 # You MUST NOT modify this file without author's consent.
 # Doing so is considered cheating!
 
+import glob
+import json
 import os
+import re
 import pexpect
 import unittest
 import subprocess
 import random
+import resource
 import time
 import sys
 from tempfile import NamedTemporaryFile
@@ -205,6 +209,38 @@ class TestShellSimple(ShellTesterSimple, unittest.TestCase):
                     'cat < include/queue.h | grep LIST | wc -l > ' + outf.name)
             self.assertEqual(int(outf.read().split()[0]), 46)
 
+    def test_parallel_pipe(self):
+        lines = self.execute('cat include/queue.h | '
+                             'parallel --pipe -j 4 -b 2048 grep LIST | wc -l')
+        self.assertEqual(lines[0], '46')
+
+        # 'parallel --pipe -k cat < include/queue.h > out'
+        with NamedTemporaryFile(mode='r') as outf:
+            self.execute('parallel --pipe -k -j 3 -b 1000 cat '
+                         '< include/queue.h > ' + outf.name)
+            self.assertEqual(outf.read(), open('include/queue.h').read())
+
+    def test_parallel_keep_order_backlog(self):
+        # Blocks held back by a slow first one must not use up descriptors.
+        self.child.close()
+        self.child = pexpect.spawn('./shell', preexec_fn=lambda:
+                                   resource.setrlimit(resource.RLIMIT_NOFILE,
+                                                      (64, 64)))
+        self.child.logfile = open(LOGFILE, 'ab')
+        self.child.setecho(False)
+        self.expect('#')
+        with NamedTemporaryFile(mode='w') as script, \
+                NamedTemporaryFile(mode='w') as inf, \
+                NamedTemporaryFile(mode='r') as outf:
+            script.write('read first\n[ "$first" = 1 ] && sleep 1\n'
+                         'echo "$first"\ncat\n')
+            script.flush()
+            inf.write(''.join(f'{i}\n' for i in range(1, 10001)))
+            inf.flush()
+            self.execute(f'parallel --pipe -k -j 2 -b 64 /bin/sh {script.name}'
+                         f' < {inf.name} > {outf.name}')
+            self.assertEqual(outf.read(), open(inf.name).read())
+
     def test_fd_leaks(self):
         # 'ls -l /proc/self/fd'
         lines = self.execute('ls -l /proc/self/fd')
@@ -292,6 +328,252 @@ class TestShellSimple(ShellTesterSimple, unittest.TestCase):
         self.sendline('jobs')
         self.expect_exact("[1] killed 'sleep 1000' by signal 15")
 
+    def test_long_notice(self):
+        # Notices used to be cut at 512 characters.
+        cmd = 'env X=' + 'x' * 1500 + ' sleep 1000'
+        self.sendline(cmd + ' &')
+        self.expect_exact(f"[1] running '{cmd}'")
+        self.sendline('kill %1')
+        self.sendline('jobs')
+        self.expect_exact(f"[1] killed '{cmd}' by signal 15")
+
+    def test_job_usage(self):
+        self.sendline('sleep 1000 | cat &')
+        self.expect_exact("[1] running 'sleep 1000 | cat'")
+        self.sendline('jobs -l')
+        self.expect(r'\s+\d+ running\r\n\s+\d+ running')
+        self.sendline('kill %1')
+        self.sendline('jobs')
+        self.expect(r"\[1\] killed 'sleep 1000 \| cat' by signal 15 "
+                    r"\(user \d+\.\d{3}s, sys \d+\.\d{3}s, maxrss [\d.]+\w, "
+                    r"ctxsw \d+/\d+, read [\d.]+\w, written [\d.]+\w\)")
+
+    def test_time(self):
+        self.sendline('time sleep 0.1')
+        self.expect(r'real 0\.1\d\ds  user \d+\.\d{3}s  sys \d+\.\d{3}s')
+        self.sendline('time -p true | false')
+        self.expect(r'time real=[\d.]+ user=[\d.]+ sys=[\d.]+ status=1')
+        self.expect(r'stage=1 pid=\d+ real=[\d.]+ .* status=0')
+        self.expect(r'stage=2 pid=\d+ real=[\d.]+ .* status=1')
+        # Stages exiting together while the reaper runs must not lose usage.
+        for _ in range(20):
+            self.sendline('time -p true | true | true | true')
+            for stage in range(1, 5):
+                self.expect(r'stage=%d pid=\d+ [^\r]* maxrss=[1-9]' % stage)
+
+    def test_bench(self):
+        self.sendline('bench -n 3 true -- false')
+        self.expect(r"'true': 3 runs\r\n\s+wall\s+mean [\d.]+s")
+        self.expect(r"'false': 3 runs, 3 failed")
+        self.expect(r"'(true|false)' ran [\d.]+ times faster than")
+        self.sendline('bench -j -n 2 -w 1 true')
+        self.expect_exact('"command": "true",')
+        self.expect_exact('"runs": 2,')
+        self.expect(r'"wall": \{"mean": [\d.]+, "stddev": [\d.]+')
+
+    def test_perf_stat(self):
+        self.sendline('perf stat true | cat')
+        self.expect_exact("Performance counter stats for 'true | cat':")
+        self.expect(r'[\d.]+ msec task-clock')
+        self.expect(r'\d+\s+context-switches')
+        self.expect_exact("1: 'true'")
+        self.expect_exact("2: 'cat'")
+        self.expect(r'[\d.]+ seconds time elapsed')
+        # With options perf(1) itself is run, if it is installed at all.
+        self.sendline('perf stat -e cycles true')
+        self.expect(r"perf: [\w ]+\r\n|"
+                    r"Performance counter stats for 'true'")
+
+    def test_jobtop(self):
+        self.sendline('sleep 1000 | cat &')
+        self.expect_exact("[1] running 'sleep 1000 | cat'")
+        self.sendline('jobtop -n 2 -d 0.1')
+        self.expect(r'jobtop: 1 jobs, 2 processes')
+        self.expect(r'\[1\]\s+R\s+[\d.]+\s+\d+K  sleep 1000 \| cat')
+        self.expect(r'\d+ S\s+[\d.]+\s+\d+K    sleep 1000')
+        self.expect(r'\d+ S\s+[\d.]+\s+\d+K    cat')
+
+    def test_shstat(self):
+        self.sendline('true | cat')
+        self.sendline('/nonexistent')
+        self.expect_exact('/nonexistent: No such file or directory')
+        self.sendline('nonexistent')
+        self.expect(r'# nonexistent: [\w ]+\r\n')
+        self.sendline('shstat -r')
+        self.expect_exact('forks 4')
+        self.expect_exact('execve failures 2')
+        self.expect(r'exec-to-reap: 4 samples')
+        self.sendline('shstat -j')
+        self.expect_exact('"forks": 0,')
+        self.expect_exact('"exec_to_reap": {"count": 0, "sum_us": 0')
+
+    def test_shstat_wrappers(self):
+        nm = subprocess.run(['nm', 'shell'], check=True,
+                            capture_output=True, text=True).stdout
+        self.sendline('true | cat')
+        self.sendline('shstat -j')
+        if '__start_wrapstat' in nm:
+            self.expect(r'"Pipe": \{"calls": 1, "errors": 0, "sum_ns": \d+')
+        else:
+            self.expect_exact('"wrappers": {}')
+
+    def test_metrics(self):
+        with NamedTemporaryFile(mode='r', suffix='.prom') as prom:
+            self.sendline('sleep 1000 &')
+            self.expect_exact("[1] running 'sleep 1000'")
+            self.sendline('metrics -i 0.1 %s' % prom.name)
+            self.sendline('metrics')
+            self.expect_exact('metrics -i 0.1 %s' % prom.name)
+            # File is written in background, wait till it shows up.
+            for _ in range(100):
+                with open(prom.name) as f:
+                    text = f.read()
+                if text:
+                    break
+                time.sleep(0.05)
+            self.assertIn('shell_jobs{state="running"} 1\n', text)
+            self.assertIn('shell_forks_total 1\n', text)
+            self.assertIn('shell_spawn_latency_seconds_count 1\n', text)
+            self.assertIn(
+                'shell_job_processes{job="1",command="sleep 1000"} 1\n', text)
+            self.sendline('metrics off')
+            self.sendline('metrics')
+            self.expect_exact('metrics off')
+            for _ in range(100):
+                if not glob.glob(prom.name + '.*.tmp'):
+                    break
+                time.sleep(0.05)
+            self.assertFalse(glob.glob(prom.name + '.*.tmp'))
+
+    def test_sdt_probes(self):
+        notes = subprocess.run(['readelf', '-n', './shell'], check=True,
+                               capture_output=True, text=True).stdout
+        probes = re.findall(r'Provider: shell\s+Name: (\w+)\s+'
+                            r'Location: 0x[0-9a-f]+, Base: 0x[0-9a-f]+, '
+                            r'Semaphore: 0x0+\s+Arguments: ?(.*)', notes)
+        probes = {name: args.split() for name, args in probes}
+        expected = {'eval__entry': 1, 'eval__return': 1, 'proc__spawn': 4,
+                    'proc__exec': 2, 'proc__state': 5, 'job__wakeup': 3,
+                    'tty__handoff': 1}
+        for name, nargs in expected.items():
+            self.assertIn(name, probes)
+            self.assertEqual(len(probes[name]), nargs)
+            for arg in probes[name]:
+                self.assertRegex(arg, r'^-?[1248]@')
+
+    def test_trace_job(self):
+        with NamedTemporaryFile(mode='w') as script:
+            script.write('/bin/true\n/bin/true\n:\n')
+            script.flush()
+            ring = script.name + '.ring'
+            try:
+                self.sendline(f'trace -o {ring} /bin/sh {script.name} | '
+                              f'/bin/sh {script.name}')
+                self.expect_exact(f"[0] tracing to '{ring}'")
+                self.expect('#')
+                self.sendline(f'/bin/sh {script.name}')
+                self.expect('#')
+                dump = subprocess.run(['./tracedump', ring], check=True,
+                                      stdout=subprocess.PIPE).stdout.decode()
+            finally:
+                if os.path.exists(ring):
+                    os.unlink(ring)
+        forks = re.findall(r'\[(\d+):(\d+)\] v?fork\(\) = (\d+)', dump)
+        self.assertEqual(len(forks), 4)
+        # Both stages record into the ring, each forking twice.
+        stages = {pid for pid, _, _ in forks}
+        self.assertEqual(len(stages), 2)
+        self.assertEqual({pgid for _, pgid, _ in forks}, {forks[0][1]})
+        self.assertIn(forks[0][1], stages)
+        for pid, pgid, child in forks:
+            self.assertIn(f'[{child}:{pgid}] execve("/bin/true"', dump)
+        self.assertNotIn(f'[{self.pid}:', dump)
+
+    def test_timeline(self):
+        self.sendline('true | cat')
+        self.sendline('sleep 1000 &')
+        self.expect_exact("[1] running 'sleep 1000'")
+        self.sendline('kill %1')
+        self.sendline('jobs')
+        self.expect_exact("[1] killed 'sleep 1000' by signal 15")
+        self.sendline('jobs --timeline')
+        self.expect_exact("[0] 'true | cat' finished")
+        self.expect(r'created    pgid (\d+)')
+        self.expect(r'forked     pid \d+')
+        self.expect(r'forked     pid \d+')
+        self.expect(r'terminal   pgid \d+')
+        self.expect(r'exited     pid \d+ status=0')
+        self.expect_exact("[1] 'sleep 1000' finished")
+        self.expect(r'exited     pid \d+ signal=15')
+        with NamedTemporaryFile(mode='r', suffix='.json') as trace:
+            self.sendline('jobs --timeline %s' % trace.name)
+            for _ in range(50):
+                text = trace.read()
+                if text.endswith('}\n'):
+                    break
+                trace.seek(0)
+                time.sleep(0.1)
+            events = json.loads(text)['traceEvents']
+        names = [e['args']['name'] for e in events if e['ph'] == 'M']
+        self.assertEqual(names, ['[0] true | cat', '[1] sleep 1000'])
+        self.assertEqual(len([e for e in events if e['ph'] == 'X']), 3)
+
+    def test_sched_queue(self):
+        self.sendline('sched -j 1')
+        self.sendline('sleep 1000 &')
+        self.expect_exact("[1] running 'sleep 1000'")
+        self.sendline('true &')
+        self.expect_exact("[2] queued 'true'")
+        self.sendline('jobs')
+        self.expect_exact("[1] running 'sleep 1000'")
+        self.expect_exact("[2] queued 'true'")
+        self.sendline('kill %1')
+        self.expect_exact("[2] running 'true'")
+        self.sendline('jobs')
+        self.expect_exact("[2] exited 'true', status=0")
+        # Time spent in the queue is part of the history of the started job.
+        self.sendline('jobs --timeline')
+        self.expect_exact("[1] 'sleep 1000' finished")
+        self.assertNotIn(b'[2]', self.child.before)
+        self.expect(r"\[2\] 'true' finished\r\n[^\r]+queued\r\n[^\r]+created")
+
+    def test_job_after(self):
+        self.sendline('sleep 1000 &')
+        self.expect_exact("[1] running 'sleep 1000'")
+        self.sendline('true & after %1')
+        self.expect_exact("[2] queued 'true' after %1")
+        self.sendline('false & afterok %1')
+        self.expect_exact("[3] queued 'false' afterok %1")
+        self.sendline('true & after %1 &')
+        self.expect_exact("usage: command & after|afterok %n ...")
+        self.sendline('jobs')
+        self.expect_exact("[2] queued 'true' after %1")
+        self.expect_exact("[3] queued 'false' afterok %1")
+        self.sendline('kill %1')
+        self.expect_exact("[2] running 'true'")
+        self.sendline('jobs')
+        self.expect_exact("[1] killed 'sleep 1000' by signal 15")
+        self.expect_exact("[3] cancelled 'false'")
+
+    def test_wait(self):
+        self.sendline('sleep 1000 &')
+        self.expect_exact("[1] running 'sleep 1000'")
+        self.sendline('sleep 0.2 &')
+        self.expect_exact("[2] running 'sleep 0.2'")
+        self.sendline('wait -n')
+        self.expect_exact("[2] exited 'sleep 0.2', status=0")
+        self.sendline('time -p wait -t 0.1 %1')
+        self.expect(r'time real=0\.\d+ [^\r]* status=124')
+        self.sendline('time -p wait %1')
+        time.sleep(0.2)
+        self.sendintr()
+        self.expect(r'time real=[\d.]+ [^\r]* status=130')
+        self.sendline('jobs')
+        self.expect_exact("[1] running 'sleep 1000'")
+        self.sendline('kill %1')
+        self.sendline('wait')
+        self.expect_exact("[1] killed 'sleep 1000' by signal 15")
+
     def test_kill_at_quit(self):
         self.sendline('sleep 1000 &')
         self.expect_exact("[1] running 'sleep 1000'")
@@ -304,6 +586,69 @@ class TestShellSimple(ShellTesterSimple, unittest.TestCase):
         self.expect_exact("[1] killed 'sleep 1000' by signal 15")
         self.expect_exact("[2] killed 'sleep 2000' by signal 15")
 
+    def test_kill_stubborn_at_quit(self):
+        with NamedTemporaryFile(mode='w', delete=False) as script:
+            script.write('#!/bin/sh\ntrap "" TERM\necho ready\nsleep 1000\n')
+        os.chmod(script.name, 0o755)
+        try:
+            self.sendline(f'{script.name} &')
+            self.expect_exact('ready')
+            self.sendline('sleep 1000 &')
+            self.expect_exact("[2] running 'sleep 1000'")
+            self.sendline('jobs')
+            self.expect_exact(f"[1] running '{script.name}'")
+            self.expect_exact("[2] running 'sleep 1000'")
+            self.sendcontrol('d')
+            self.expect_exact(f"[1] killed '{script.name}' by signal 9")
+            self.expect_exact("[2] killed 'sleep 1000' by signal 15")
+        finally:
+            os.unlink(script.name)
+
+    def test_riobench(self):
+        # Lines crossing buffer boundaries, longer than buffer, empty and last
+        # one without newline.
+        lengths = [8190, 1, 8192, 0, 20000, 3, 40000] + \
+            [random.randrange(100) for _ in range(1000)] + [5]
+        with NamedTemporaryFile(mode='w') as data:
+            data.write('\n'.join('x' * n for n in lengths))
+            data.flush()
+            out = subprocess.run(['./riobench', '-n', '1', data.name],
+                                 check=True, stdout=subprocess.PIPE)
+        results = re.findall(r'(?m)^(\w+) .* (\d+) lines  checksum (\w+)$',
+                             out.stdout.decode())
+        self.assertEqual([r[0] for r in results],
+                         ['bytewise', 'readlineb', 'readlinev', 'mapped',
+                          'writen', 'writeb', 'writevb'])
+        for _, lines, checksum in results:
+            self.assertEqual(int(lines), len(lengths))
+            self.assertEqual(checksum, results[0][2])
+
+    def test_uringbench(self):
+        with NamedTemporaryFile() as data:
+            data.write(os.urandom(300000))
+            data.flush()
+            out = subprocess.run(['./uringbench', '-n', '1', '-d', '.',
+                                  data.name], check=True,
+                                 stdout=subprocess.PIPE).stdout.decode()
+        results = re.findall(r'(?m)^(\w+(?: \w+)?) .* (\d+) (?:entries|bytes)'
+                             r' +checksum (\w+)$', out)
+        self.assertEqual([r[0] for r in results],
+                         ['statx', 'statx uring', 'read rio', 'read uring'])
+        self.assertEqual(results[0][1:], results[1][1:])
+        self.assertEqual(results[2][1:], results[3][1:])
+        self.assertEqual(int(results[2][1]), 300000)
+
+    def test_hmapbench(self):
+        out = subprocess.run(['./hmapbench', '-n', '3000', '-r', '1'],
+                             check=True,
+                             stdout=subprocess.PIPE).stdout.decode()
+        results = re.findall(r'(?m)^(\w+) +(\w+) .* found (\d+)/(\d+)$', out)
+        self.assertEqual([r[:2] for r in results],
+                         [(k, m) for k in ('str', 'pid')
+                          for m in ('hashmap', 'fixed', 'rbtree')])
+        for r in results:
+            self.assertEqual(r[2:], ('3000', '0'))
+
 
 class TestShellWithSyscalls(ShellTester, unittest.TestCase):
     def stty(self):
@@ -379,6 +724,106 @@ class TestShellWithSyscalls(ShellTester, unittest.TestCase):
         self.assertEqual(stty_before, stty_after)
 
 
+    def run_traced(self, cmd, *dump_args, env=None):
+        """ Runs `cmd` in a shell that records its calls into a trace ring.
+        Returns pid of the shell and what tracedump `dump_args` prints. """
+        with NamedTemporaryFile() as tmp:
+            ring = tmp.name + '.ring'
+        env = dict(os.environ, TRACE_RING=ring, **(env or {}))
+        try:
+            shell = pexpect.spawn('./shell', env=env)
+            shell.setecho(False)
+            shell.expect('#')
+            shell.sendline(cmd)
+            shell.expect('#')
+            shell.sendline('quit')
+            shell.wait()
+            dump = subprocess.run(['./tracedump', *dump_args, ring],
+                                  check=True,
+                                  env=dict(os.environ, LD_PRELOAD=''),
+                                  stdout=subprocess.PIPE).stdout.decode()
+        finally:
+            if os.path.exists(ring):
+                os.unlink(ring)
+        return shell.pid, dump
+
+    def test_trace_ring(self):
+        _, dump = self.run_traced('/bin/true',
+                                  env={'TRACE_FILTER': 'fork,execve'})
+        self.assertRegex(dump, r'\] fork\(\) = \d+')
+        self.assertIn('execve("/bin/true"', dump)
+        self.assertNotRegex(dump, r'\] (open|close|waitpid)\(')
+
+    def test_trace_setsid(self):
+        # Records made after setsid carry the new process group.
+        with NamedTemporaryFile(mode='w', suffix='.py') as script:
+            script.write('import os\n'
+                         'if os.fork() == 0:\n'
+                         '    os.close(os.dup(1))\n'
+                         '    os.setsid()\n'
+                         '    if os.fork() == 0:\n'
+                         '        os._exit(0)\n'
+                         '    os.wait()\n'
+                         '    os._exit(0)\n'
+                         'os.wait()\n')
+            script.flush()
+            _, dump = self.run_traced(f'/usr/bin/python3 {script.name}',
+                                      env={'TRACE_FILTER': 'close,fork'})
+        forks = re.findall(r'\[(\d+):\d+\] fork\(\) = (\d+)', dump)
+        python = forks[0][1]
+        leader = [child for pid, child in forks if pid == python][0]
+        self.assertIn(f'[{leader}:{leader}] fork() = ', dump)
+
+    def test_trace_latency(self):
+        with NamedTemporaryFile(mode='r') as hist:
+            pid, dump = self.run_traced('/bin/true | /bin/cat', '-l',
+                                        env={'TRACE_HIST': hist.name})
+            blocks = hist.read().split('# pid ')
+        shell = [b for b in blocks if b.startswith(f'{pid} ')]
+        self.assertEqual(len(shell), 1)
+        self.assertRegex(shell[0], r'\nfork: 2 calls, total \S+, max \S+\n')
+        self.assertRegex(shell[0], r'\npipe: 1 calls')
+        self.assertRegex(shell[0], r'\n  \[ *\S+, *\S+\) +1\n')
+        self.assertRegex(dump, r'(?m)^fork: 2 calls')
+        self.assertRegex(dump, r'(?m)^waitpid: \d+ calls')
+
+    def test_trace_clone_hist(self):
+        # A clone child does not count calls its parent made before.
+        with NamedTemporaryFile(mode='w', suffix='.py') as script, \
+                NamedTemporaryFile(mode='r') as hist:
+            script.write('import ctypes, os, signal\n'
+                         'libc = ctypes.CDLL(None)\n'
+                         'os.close(os.dup(1))\n'
+                         'child = ctypes.CFUNCTYPE(ctypes.c_int, '
+                         'ctypes.c_void_p)(lambda _: libc.exit(0))\n'
+                         'stack = ctypes.create_string_buffer(1 << 20)\n'
+                         'top = ctypes.c_void_p(ctypes.addressof(stack) + '
+                         '(1 << 20))\n'
+                         'pid = libc.clone(child, top, signal.SIGCHLD, None)\n'
+                         'os.waitpid(pid, 0)\n')
+            script.flush()
+            self.run_traced(f'/usr/bin/python3 {script.name}',
+                            env={'TRACE_HIST': hist.name,
+                                 'TRACE_FILTER': 'close,clone',
+                                 'ASAN_OPTIONS': 'detect_leaks=0'})
+            blocks = re.findall(r'# pid \d+ \(python3\)\n', hist.read())
+        self.assertEqual(len(blocks), 1)
+
+    def test_trace_chrome(self):
+        pid, dump = self.run_traced('/bin/true | /bin/cat', '-j')
+        events = json.loads(dump)['traceEvents']
+        spans = {e['name']: e for e in events if e['ph'] == 'X'}
+        true, cat = spans['true'], spans['cat']
+        self.assertEqual(true['args']['ppid'], pid)
+        self.assertEqual(cat['args']['ppid'], pid)
+        self.assertEqual(true['pid'], true['tid'])
+        self.assertEqual(cat['pid'], true['tid'])
+        flows = [e for e in events if e['ph'] in 'sf']
+        self.assertEqual(len(flows), 4)
+        handoffs = [e['name'] for e in events if e['ph'] == 'i']
+        self.assertIn(f"terminal to {true['pid']}", handoffs)
+        self.assertIn(f'terminal to {pid}', handoffs)
+
 if __name__ == '__main__':
     os.environ['PATH'] = '/usr/bin:/bin'
     os.environ['LC_ALL'] = 'C'
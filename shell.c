@@ -9,6 +9,49 @@
 
 sigset_t sigchld_mask;
 
+static bool perfstat = false; /* count events of new processes */
+static int perfsock[2];       /* passes counters from new process to shell */
+
+static bool tracejob = false;     /* preload trace.so into new processes */
+static const char *tracepath;     /* ring of traced job, or NULL for default */
+static char tracelib[PATH_MAX];   /* trace.so found next to the shell */
+static char tracering[PATH_MAX];  /* ring that traced job records into */
+
+/* Choose ring of traced job before its first process is forked. Ring left by
+ * an earlier job is removed here rather than by the group leader, which could
+ * run after later stages of the pipeline had attached to the ring. */
+static void trace_prepare(void) {
+  static int ntraced = 0;
+  if (tracepath)
+    snprintf(tracering, sizeof(tracering), "%s", tracepath);
+  else
+    snprintf(tracering, sizeof(tracering), "trace.%d.%d", (int)getpid(),
+             ++ntraced);
+  (void)unlink(tracering);
+}
+
+/* Make a new process of traced job preload trace.so. */
+static void trace_attach(void) {
+  char *preload = getenv("LD_PRELOAD");
+  if (preload && *preload) {
+    char *lib = strdup(tracelib);
+    strapp(&lib, ":");
+    strapp(&lib, preload);
+    setenv("LD_PRELOAD", lib, 1);
+    free(lib);
+  } else {
+    setenv("LD_PRELOAD", tracelib, 1);
+  }
+  setenv("TRACE_RING", tracering, 1);
+}
+
+/* Collect counters opened by the process most recently added to a job. */
+static void addperf(int job) {
+  int fd[NCOUNTERS];
+  perf_receive(perfsock, fd);
+  addcounters(job, fd);
+}
+
 static void sigint_handler(int sig) {
   /* No-op handler, we just need break read() call with EINTR. */
   (void)sig;
@@ -71,11 +114,16 @@ static int do_job(token_t *token, int ntokens, bool bg) {
 
   /* TODO: Start a subprocess, create a job and monitor it. */
 #ifdef STUDENT
+  if (perfstat)
+    perf_prepare(perfsock);
+  if (tracejob)
+    trace_prepare();
   pid_t pid = Fork();
   if (pid == 0) {
-    setpgid(getpid(), getpid());
+    pid = getpid();
+    setpgid(pid, pid);
     if (!bg)
-      setfgpgrp(getpid());
+      setfgpgrp(pid);
 
     Sigprocmask(SIG_SETMASK, &mask, NULL);
     Signal(SIGINT, SIG_DFL);
@@ -84,6 +132,10 @@ static int do_job(token_t *token, int ntokens, bool bg) {
     Signal(SIGTTOU, SIG_DFL);
     Signal(SIGCHLD, SIG_DFL);
     Signal(SIGQUIT, SIG_DFL);
+    if (perfstat)
+      perf_attach(perfsock);
+    if (tracejob)
+      trace_attach();
 
     if (input != -1) {
       Dup2(input, STDIN_FILENO);
@@ -94,21 +146,28 @@ static int do_job(token_t *token, int ntokens, bool bg) {
       MaybeClose(&output);
     }
 
+    SDT_PROBE2(shell, proc__exec, pid, pid);
     external_command(token);
     perror("exec error :(");
     exit(EXIT_FAILURE);
 
   } else {
+    STAT_INC(forks);
+    shstat_spawn();
     setpgid(pid, pid);
     if (!bg)
       setfgpgrp(pid);
     int job = addjob(pid, bg);
     addproc(job, pid, token);
+    if (perfstat)
+      addperf(job);
+    if (tracejob)
+      msg("[%d] tracing to '%s'\n", job, tracering);
 
     if (!bg) {
       exitcode = monitorjob(&mask);
     } else {
-      safe_printf("[%d] running '%s'\n", job, jobcmd(job));
+      safe_log("[%d] running '%s'\n", job, jobcmd(job));
     }
 
     MaybeClose(&input);
@@ -131,15 +190,18 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
     app_error("ERROR: Command line is not well formed!");
 
   /* TODO: Start a subprocess and make sure it's moved to a process group. */
+  if (perfstat)
+    perf_prepare(perfsock);
   pid_t pid = Fork();
 #ifdef STUDENT
   if (pid == 0) {
+    pid = getpid();
     if (pgid > 0)
-      setpgid(getpid(), pgid);
+      setpgid(pid, pgid);
     else {
-      setpgid(getpid(), getpid());
+      setpgid(pid, pgid = pid);
       if (!bg)
-        setfgpgrp(getpid());
+        setfgpgrp(pid);
     }
 
     Sigprocmask(SIG_SETMASK, mask, NULL);
@@ -149,6 +211,10 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
     Signal(SIGTTOU, SIG_DFL);
     Signal(SIGCHLD, SIG_DFL);
     Signal(SIGQUIT, SIG_DFL);
+    if (perfstat)
+      perf_attach(perfsock);
+    if (tracejob)
+      trace_attach();
 
     if (input != -1) {
       Dup2(input, STDIN_FILENO);
@@ -158,11 +224,14 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
       Dup2(output, STDOUT_FILENO);
       MaybeClose(&output);
     }
+    SDT_PROBE2(shell, proc__exec, pid, pgid);
     external_command(token);
     perror("exec error :(");
     exit(EXIT_FAILURE);
 
   } else {
+    STAT_INC(forks);
+    shstat_spawn();
     if (pgid > 0)
       setpgid(pid, pgid);
     else {
@@ -213,10 +282,16 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
     }
   }
   /* first process - group leader */
+  if (tracejob)
+    trace_prepare();
   pid = do_stage(-1, &mask, input, output, token, x[1], bg);
   pgid = pid;
   job = addjob(pgid, bg);
   addproc(job, pid, token);
+  if (perfstat)
+    addperf(job);
+  if (tracejob)
+    msg("[%d] tracing to '%s'\n", job, tracering);
 
   /* middle processes */
   for (int p = 1; p < nproc; p++) {
@@ -227,6 +302,8 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
     pid = do_stage(pgid, &mask, input, output, token + x[p] + 1,
                    x[p + 1] - x[p] - 1, bg);
     addproc(job, pid, token + x[p] + 1);
+    if (perfstat)
+      addperf(job);
   }
 
   /* last process */
@@ -236,12 +313,14 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
   pid = do_stage(pgid, &mask, input, output, token + x[nproc] + 1,
                  ntokens - x[nproc] - 1, bg);
   addproc(job, pid, token + x[nproc] + 1);
+  if (perfstat)
+    addperf(job);
   MaybeClose(&input);
   MaybeClose(&output);
   if (!bg) {
     exitcode = monitorjob(&mask);
   } else {
-    safe_printf("[%d] running '%s'\n", job, jobcmd(job));
+    safe_log("[%d] running '%s'\n", job, jobcmd(job));
   }
 
   (void)input;
@@ -262,27 +341,179 @@ static bool is_pipeline(token_t *token, int ntokens) {
   return false;
 }
 
+static int run(token_t *token, int ntokens, bool bg) {
+  if (is_pipeline(token, ntokens))
+    return do_pipeline(token, ntokens, bg);
+  return do_job(token, ntokens, bg);
+}
+
+/* Split off list of jobs that a background job waits for, i.e. the part
+ * following 'cmd &' that reads 'after %n ...' or 'afterok %n ...'. */
+static char **split_after(token_t *token, int *ntokensp, bool *afterokp) {
+  for (int i = 0; i < *ntokensp - 1; i++) {
+    if (token[i] != T_BGJOB || !string_p(token[i + 1]))
+      continue;
+    if (strcmp(token[i + 1], "after") && strcmp(token[i + 1], "afterok"))
+      continue;
+    *afterokp = !strcmp(token[i + 1], "afterok");
+    *ntokensp = i + 1;
+    return &token[i + 2];
+  }
+  return NULL;
+}
+
+/* Strip `time [-p]` or `perf stat` keyword off the command line. `perf stat`
+ * followed by an option is left to perf(1). Returns the first token of the
+ * command itself. */
+static token_t *split_time(token_t *token, int *ntokensp, bool *parsablep,
+                           bool *perfp) {
+  int n = 0;
+  if (*ntokensp > 0 && string_p(token[0]) && !strcmp(token[0], "time")) {
+    n = 1;
+    if (n < *ntokensp && string_p(token[n]) && !strcmp(token[n], "-p")) {
+      *parsablep = true;
+      n++;
+    }
+  } else if (*ntokensp > 1 && string_p(token[0]) && string_p(token[1]) &&
+             !strcmp(token[0], "perf") && !strcmp(token[1], "stat") &&
+             !(*ntokensp > 2 && string_p(token[2]) && token[2][0] == '-')) {
+    *perfp = true;
+    n = 2;
+  }
+  *ntokensp -= n;
+  return &token[n];
+}
+
+/* Strip `trace [-o file]` keyword off the command line. Returns the first
+ * token of the command itself, or NULL if trace.so could not be found. */
+static token_t *split_trace(token_t *token, int *ntokensp, bool *tracep) {
+  int n = 0;
+  if (*ntokensp > 0 && string_p(token[0]) && !strcmp(token[0], "trace")) {
+    *tracep = true;
+    tracepath = NULL;
+    n = 1;
+    if (n + 1 < *ntokensp && string_p(token[n]) && !strcmp(token[n], "-o") &&
+        string_p(token[n + 1])) {
+      tracepath = token[n + 1];
+      n += 2;
+    }
+    if (tracelib[0] == '\0') {
+      size_t len = Readlink("/proc/self/exe", tracelib,
+                            sizeof(tracelib) - sizeof("trace.so"));
+      tracelib[len] = '\0';
+      strcpy(strrchr(tracelib, '/') + 1, "trace.so");
+    }
+    if (access(tracelib, R_OK) < 0)
+      return NULL;
+  }
+  *ntokensp -= n;
+  return &token[n];
+}
+
 static void eval(char *cmdline) {
-  bool bg = false;
+  bool bg = false, afterok = false, parsable = false, perf = false;
   int ntokens;
+  size_t heap = shstat_eval(0);
+  SDT_PROBE1(shell, eval__entry, (uintptr_t)cmdline);
+  char *saved = strdup(cmdline);
   token_t *token = tokenize(cmdline, &ntokens);
-
-  if (ntokens > 0 && token[ntokens - 1] == T_BGJOB) {
-    token[--ntokens] = NULL;
+  STAT_INC(lines);
+  STAT_ADD(tokens, ntokens);
+  char **after = split_after(token, &ntokens, &afterok);
+  token_t *cmd = split_time(token, &ntokens, &parsable, &perf);
+  bool timed = cmd != token;
+
+  if (ntokens > 0 && cmd[ntokens - 1] == T_BGJOB) {
+    cmd[--ntokens] = NULL;
     bg = true;
   }
 
-  if (ntokens > 0) {
-    if (is_pipeline(token, ntokens)) {
-      do_pipeline(token, ntokens, bg);
+  /* Queued jobs keep the keyword, which is stripped when they are started. */
+  cmd = split_trace(cmd, &ntokens, &tracejob);
+
+  if (cmd == NULL) {
+    msg("trace: %s: %s\n", tracelib, strerror(errno));
+  } else if (tracejob && ntokens == 0) {
+    msg("usage: trace [-o file] command\n");
+  } else if (timed) {
+    if (bg || ntokens == 0) {
+      msg("usage: time [-p] command | perf stat command\n");
+    } else if (perf) {
+      timestart();
+      perfstat = true;
+      run(cmd, ntokens, false);
+      perfstat = false;
+      perfreport();
+    } else {
+      timestart();
+      timereport(run(cmd, ntokens, false), parsable);
+    }
+  } else if (ntokens > 0) {
+    if (after) {
+      /* Job will be started with the 'after ...' part cut off. */
+      saved[after[-1] - cmdline] = '\0';
+      if (queuejob(saved, after, afterok) >= 0)
+        saved = NULL;
+    } else if (bg && !admitjob()) {
+      queuejob(saved, NULL, false);
+      saved = NULL;
     } else {
-      do_job(token, ntokens, bg);
+      run(cmd, ntokens, bg);
     }
   }
 
+  tracejob = false;
+  free(saved);
   free(token);
+  shstat_eval(heap);
+  SDT_PROBE1(shell, eval__return, ntokens);
 }
 
+/* Start a background job that has just left the queue. */
+static void startjob(char *cmdline) {
+  int ntokens;
+  token_t *token = tokenize(cmdline, &ntokens);
+  assert(ntokens > 0 && token[ntokens - 1] == T_BGJOB);
+  token[--ntokens] = NULL;
+  token_t *cmd = split_trace(token, &ntokens, &tracejob);
+  if (cmd == NULL) {
+    msg("trace: %s: %s\n", tracelib, strerror(errno));
+    unreservejob();
+  } else {
+    run(cmd, ntokens, BG);
+  }
+  tracejob = false;
+  free(token);
+  free(cmdline);
+}
+
+/* Start background jobs that admission control let out of the queue. */
+void startjobs(void) {
+  char *cmdline;
+  while (dequeuejob(&cmdline))
+    startjob(cmdline);
+  safe_logflush(STDERR_FILENO);
+}
+
+#ifdef READLINE
+/* Called by readline about ten times a second while it waits for input. */
+static int idle_hook(void) {
+  char *cmdline;
+  metrics_export(false);
+  if (!dequeuejob(&cmdline))
+    return 0;
+
+  /* Messages about started jobs must not get mixed with the prompt. */
+  rl_clear_visible_line();
+  do {
+    startjob(cmdline);
+  } while (dequeuejob(&cmdline));
+  safe_logflush(STDERR_FILENO);
+  rl_forced_update_display();
+  return 0;
+}
+#endif
+
 #ifndef READLINE
 static char *readline(const char *prompt) {
   static char line[MAXLINE]; /* `readline` is clearly not reentrant! */
@@ -322,6 +553,7 @@ int main(int argc, char *argv[]) {
   if (getsid(0) != getpgid(0))
     Setpgid(0, 0);
 
+  shstat_init();
   initjobs();
 
   struct sigaction act = {
@@ -335,21 +567,30 @@ int main(int argc, char *argv[]) {
   Signal(SIGTTOU, SIG_IGN);
 
   while (true) {
+#ifdef READLINE
+    rl_event_hook = queuedjobs() || metrics_enabled() ? idle_hook : NULL;
+#endif
+    /* Job notices gathered since last prompt are written out at once. */
+    safe_logflush(STDERR_FILENO);
     char *line = readline("# ");
 
     if (line == NULL)
       break;
 
     if (strlen(line)) {
+      shstat_accept();
 #ifdef READLINE
       add_history(line);
 #endif
       eval(line);
     }
     free(line);
-    watchjobs(FINISHED);
+    startjobs();
+    watchjobs(FINISHED, false);
+    metrics_export(false);
   }
 
+  safe_logflush(STDERR_FILENO);
   msg("\n");
   shutdownjobs();
 
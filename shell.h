@@ -2,6 +2,7 @@
 #define _SHELL_H_
 
 #include "csapp.h"
+#include "sdt.h"
 
 #define msg(...) dprintf(STDERR_FILENO, __VA_ARGS__)
 
@@ -41,6 +42,7 @@ enum {
   FINISHED = 0, /* only jobs that have finished */
   RUNNING = 1,  /* only jobs that are still running */
   STOPPED = 2,  /* jobs that have been suspended by SIGTSTP / SIGSTOP */
+  QUEUED = 3,   /* background jobs held back by admission control */
 };
 
 void initjobs(void);
@@ -49,16 +51,88 @@ void shutdownjobs(void);
 int addjob(pid_t pgid, int bg);
 void addproc(int job, pid_t pid, char **argv);
 bool killjob(int job);
-void watchjobs(int state);
+void watchjobs(int state, bool verbose);
+int timeline(const char *path);
 char *jobcmd(int job);
 bool resumejob(int job, int bg, sigset_t *mask);
 int monitorjob(sigset_t *mask);
+int waitjobs(char **argv, bool any, double timeout);
+void timestart(void);
+void timereport(int status, bool parsable);
+void perfreport(void);
+
+bool admitjob(void);
+int queuejob(char *cmdline, char **after, bool afterok);
+int dequeuejob(char **cmdlinep);
+void unreservejob(void);
+int queuedjobs(void);
+void startjobs(void);
+
+bool sched_admit(int running);
+int do_sched(char **argv);
 
 void setfgpgrp(pid_t pgid);
 
 int builtin_command(char **argv);
 noreturn void external_command(char **argv);
 
+/* Performance counters collected for `perf stat` keyword. */
+#define NCOUNTERS 6
+#define NOTCOUNTED UINT64_MAX /* value of a counter that was not read */
+extern const char *counter_name[NCOUNTERS];
+void addcounters(int job, int fd[NCOUNTERS]);
+int perf_paranoid(void);
+void perf_prepare(int sock[2]);
+void perf_attach(int sock[2]);
+void perf_receive(int sock[2], int fd[NCOUNTERS]);
+void perf_read(int fd[NCOUNTERS], uint64_t value[NCOUNTERS]);
+
+int do_parallel(char **argv);
+int do_bench(char **argv);
+int do_jobtop(char **argv);
+int do_shstat(char **argv);
+int do_metrics(char **argv);
+
+bool metrics_enabled(void);
+void metrics_export(bool force);
+
+/* Self-instrumentation counters reported by `shstat` builtin. */
+#define NBUCKETS 32
+
+typedef struct {
+  unsigned long count;            /* number of samples */
+  unsigned long sum;              /* sum of samples in microseconds */
+  unsigned long bucket[NBUCKETS]; /* bucket k counts samples below 2^k us */
+} hist_t;
+
+typedef struct {
+  unsigned long forks;     /* processes started for jobs */
+  unsigned long execfail;  /* commands that could not be executed */
+  unsigned long sigchld;   /* SIGCHLD deliveries */
+  unsigned long waitpid;   /* waitpid calls made by the reaper */
+  unsigned long wakeups;   /* Sigsuspend wakeups while monitoring a job */
+  unsigned long lines;     /* command lines evaluated */
+  unsigned long tokens;    /* tokens in those lines */
+  unsigned long allocated; /* bytes allocated during evaluation */
+  hist_t prompt2exec;      /* from reading a line to starting its job */
+  hist_t exec2reap;        /* from starting a process to reaping it */
+} shstat_t;
+
+extern shstat_t *shstat;
+
+#define STAT_ADD(field, n)                                                     \
+  __atomic_fetch_add(&shstat->field, (n), __ATOMIC_RELAXED)
+#define STAT_INC(field) STAT_ADD(field, 1)
+
+void shstat_init(void);
+void shstat_hist(hist_t *hist, long usec);
+void shstat_accept(void);
+void shstat_spawn(void);
+size_t shstat_eval(size_t before);
+long usecs(const struct timespec *from, const struct timespec *to);
+double elapsed(const struct timespec *from, const struct timespec *to);
+double seconds(struct timeval tv);
+
 /* Used by Sigprocmask to enter critical section protecting against SIGCHLD. */
 extern sigset_t sigchld_mask;
 
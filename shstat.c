@@ -0,0 +1,191 @@
+#include "shell.h"
+#include <malloc.h>
+
+/*
+ * Self-instrumentation of the shell:
+ *
+ *   shstat [-j] [-r]
+ *
+ * Counters are bumped on hot paths with relaxed atomic additions, so they can
+ * be safely updated from signal handlers. They live in a shared anonymous
+ * mapping inherited by subprocesses, so commands that fail to execute are
+ * counted even though that happens after fork. Latency histograms have
+ * logarithmic buckets: bucket k counts samples below 2^k microseconds.
+ *
+ * 'shstat' prints all counters and non-empty histogram buckets, '-j' prints
+ * them in JSON format and '-r' resets them after they have been printed.
+ *
+ * If the shell is built with CSAPP_STATS=1, calls made by libcsapp wrappers
+ * are counted and timed too, see WRAPSTAT in csapp.h.
+ */
+
+shstat_t *shstat;
+
+static struct timespec accepted; /* when last command line was read */
+
+#if defined(__SANITIZE_ADDRESS__) &&                                          \
+  __has_include(<sanitizer/allocator_interface.h>)
+#define MALLOC_HOOKS
+#include <sanitizer/allocator_interface.h>
+
+/* AddressSanitizer replaces malloc, but lets us observe every allocation. */
+static size_t heap_allocated;
+
+static void malloc_hook(const volatile void *ptr, size_t size) {
+  (void)ptr;
+  heap_allocated += size;
+}
+
+static void free_hook(const volatile void *ptr) {
+  (void)ptr;
+}
+
+static size_t allocated(void) {
+  return heap_allocated;
+}
+#else
+/* Without a way to observe allocations use growth of heap in use. */
+static size_t allocated(void) {
+  return mallinfo2().uordblks;
+}
+#endif
+
+void shstat_init(void) {
+  shstat = Mmap(NULL, sizeof(shstat_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+#ifdef MALLOC_HOOKS
+  __sanitizer_install_malloc_and_free_hooks(malloc_hook, free_hook);
+#endif
+}
+
+long usecs(const struct timespec *from, const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000000L +
+         (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+double elapsed(const struct timespec *from, const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) * 1e-9;
+}
+
+double seconds(struct timeval tv) {
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* Add a sample to a histogram. Async-signal-safe. */
+void shstat_hist(hist_t *hist, long usec) {
+  int k = 0;
+  while (k < NBUCKETS - 1 && usec >= (1L << k))
+    k++;
+  __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->sum, max(usec, 0L), __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hist->bucket[k], 1, __ATOMIC_RELAXED);
+}
+
+/* A command line has been read. */
+void shstat_accept(void) {
+  clock_gettime(CLOCK_MONOTONIC, &accepted);
+}
+
+/* First process of a job read from the prompt has been started. */
+void shstat_spawn(void) {
+  struct timespec now;
+  if (accepted.tv_sec == 0)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  shstat_hist(&shstat->prompt2exec, usecs(&accepted, &now));
+  accepted.tv_sec = 0;
+}
+
+/* Mark the beginning and end of evaluation of a command line. */
+size_t shstat_eval(size_t before) {
+  size_t now = allocated();
+  if (before > 0 && now > before)
+    STAT_ADD(allocated, now - before);
+  return now;
+}
+
+static void hist_print(const char *name, hist_t *hist) {
+  msg("%s: %lu samples", name, hist->count);
+  if (hist->count)
+    msg(", mean %luus", hist->sum / hist->count);
+  msg("\n");
+  for (int k = 0; k < NBUCKETS; k++)
+    if (hist->bucket[k])
+      msg("  < %10ldus %lu\n", 1L << k, hist->bucket[k]);
+}
+
+static void hist_json(const char *name, hist_t *hist, bool last) {
+  msg("  \"%s\": {\"count\": %lu, \"sum_us\": %lu, \"buckets\": {", name,
+      hist->count, hist->sum);
+  const char *sep = "";
+  for (int k = 0; k < NBUCKETS; k++) {
+    if (hist->bucket[k]) {
+      msg("%s\"%ld\": %lu", sep, 1L << k, hist->bucket[k]);
+      sep = ", ";
+    }
+  }
+  msg("}}%s\n", last ? "" : ",");
+}
+
+int do_shstat(char **argv) {
+  bool json = false, reset = false;
+
+  for (; *argv; argv++) {
+    if (!strcmp(*argv, "-j"))
+      json = true;
+    else if (!strcmp(*argv, "-r"))
+      reset = true;
+    else {
+      msg("usage: shstat [-j] [-r]\n");
+      return 2;
+    }
+  }
+
+  shstat_t st = *shstat;
+
+  if (json) {
+    msg("{\n");
+    msg("  \"forks\": %lu,\n  \"execve_failed\": %lu,\n", st.forks,
+        st.execfail);
+    msg("  \"sigchld\": %lu,\n  \"waitpid\": %lu,\n", st.sigchld, st.waitpid);
+    msg("  \"wakeups\": %lu,\n  \"lines\": %lu,\n", st.wakeups, st.lines);
+    msg("  \"tokens\": %lu,\n  \"allocated\": %lu,\n", st.tokens, st.allocated);
+    hist_json("prompt_to_exec", &st.prompt2exec, false);
+    hist_json("exec_to_reap", &st.exec2reap, false);
+    msg("  \"wrappers\": {");
+    const char *sep = "";
+    wrapstat_foreach(ws) {
+      if (ws->calls == 0)
+        continue;
+      msg("%s\n    \"%s\": {\"calls\": %lu, \"errors\": %lu, "
+          "\"sum_ns\": %lu, \"max_ns\": %lu}",
+          sep, ws->name, ws->calls, ws->errors, ws->nsecs, ws->maxnsecs);
+      sep = ",";
+    }
+    msg("%s}\n}\n", *sep ? "\n  " : "");
+  } else {
+    unsigned long lines = max(st.lines, 1UL);
+    msg("forks %lu\n", st.forks);
+    msg("execve failures %lu\n", st.execfail);
+    msg("SIGCHLD deliveries %lu\n", st.sigchld);
+    msg("waitpid calls %lu\n", st.waitpid);
+    msg("Sigsuspend wakeups %lu\n", st.wakeups);
+    msg("lines %lu\n", st.lines);
+    msg("tokens %lu (%.1f per line)\n", st.tokens, (double)st.tokens / lines);
+    msg("bytes allocated %lu (%lu per line)\n", st.allocated,
+        st.allocated / lines);
+    hist_print("prompt-to-exec", &st.prompt2exec);
+    hist_print("exec-to-reap", &st.exec2reap);
+    wrapstat_foreach(ws) {
+      if (ws->calls)
+        msg("%s: %lu calls, %lu errors, mean %luns, max %luns\n", ws->name,
+            ws->calls, ws->errors, ws->nsecs / ws->calls, ws->maxnsecs);
+    }
+  }
+
+  if (reset) {
+    memset(shstat, 0, sizeof(shstat_t));
+    wrapstat_reset();
+  }
+  return 0;
+}
@@ -0,0 +1,196 @@
+#include "jobs.h"
+#include "rio.h"
+
+/*
+ * Job journals: every job keeps a ring of its most recent state transitions
+ * (see EV_* in jobs.h), recorded wherever the job table changes. Journals of
+ * finished jobs, foreground ones included, are kept in a short history.
+ *
+ *   jobs --timeline [file]
+ *
+ * Without `file` journals of recently finished jobs and of present jobs are
+ * displayed, each event with time since the first event of its job and
+ * since the previous one. With `file` they are written in Chrome trace event
+ * format, to be opened with chrome://tracing or Perfetto: every job becomes
+ * a process, every process of a job a thread with a slice spanning its life.
+ */
+
+#define NHISTORY 8
+
+typedef struct {
+  int job;              /* job number, FG for foreground jobs */
+  unsigned long serial; /* unique job identifier */
+  char *command;        /* textual representation of command line */
+  journal_t journal;
+} history_t;
+
+static history_t history[NHISTORY];
+static unsigned nhistory; /* jobs archived so far, may exceed NHISTORY */
+
+static const char *event_name[] = {
+  [EV_QUEUED] = "queued",         [EV_CREATED] = "created",
+  [EV_FORKED] = "forked",         [EV_STOPPED] = "stopped",
+  [EV_CONTINUED] = "continued",   [EV_FOREGROUND] = "foreground",
+  [EV_BACKGROUND] = "background", [EV_TERMINAL] = "terminal",
+  [EV_EXITED] = "exited",
+};
+
+/* Append an event to a journal. Async-signal-safe. */
+void record(journal_t *journal, int type, pid_t pid, int status) {
+  event_t *ev = &journal->event[journal->nevents++ % NEVENTS];
+  clock_gettime(CLOCK_MONOTONIC, &ev->when);
+  ev->pid = pid;
+  ev->type = type;
+  ev->status = status;
+}
+
+/* Keep journal of a job that is about to be deleted. */
+void archive(job_t *job, int j) {
+  history_t *h = &history[nhistory++ % NHISTORY];
+  free(h->command);
+  h->job = j;
+  h->serial = job->serial;
+  h->command = strdup(job->command ? job->command : "");
+  h->journal = job->journal;
+}
+
+/* Journal of the most recently archived job. */
+journal_t *lastjournal(void) {
+  assert(nhistory > 0);
+  return &history[(nhistory - 1) % NHISTORY].journal;
+}
+
+/* Iterate over events of a journal in chronological order. */
+#define foreach_event(ev, journal)                                             \
+  for (unsigned _i = (journal)->nevents > NEVENTS                              \
+                       ? (journal)->nevents - NEVENTS                          \
+                       : 0;                                                    \
+       _i < (journal)->nevents &&                                              \
+       ((ev) = &(journal)->event[_i % NEVENTS], true);                         \
+       _i++)
+
+static void show(rio_writer_t *out, int j, const char *command,
+                 journal_t *journal, const char *what) {
+  event_t *ev, *first = NULL, *prev = NULL;
+
+  rio_printfb(out, "[%d] '%s' %s\n", j, command, what);
+  if (journal->nevents > NEVENTS)
+    rio_printfb(out, "  (%u earlier events dropped)\n",
+                journal->nevents - NEVENTS);
+
+  foreach_event(ev, journal) {
+    if (first == NULL)
+      first = prev = ev;
+    char info[64];
+    if (ev->type == EV_EXITED && WIFSIGNALED(ev->status))
+      snprintf(info, sizeof(info), "pid %d signal=%d", (int)ev->pid,
+               WTERMSIG(ev->status));
+    else if (ev->type == EV_EXITED)
+      snprintf(info, sizeof(info), "pid %d status=%d", (int)ev->pid,
+               WEXITSTATUS(ev->status));
+    else if (ev->type == EV_TERMINAL || ev->type == EV_CREATED)
+      snprintf(info, sizeof(info), "pgid %d", (int)ev->pid);
+    else if (ev->pid)
+      snprintf(info, sizeof(info), "pid %d", (int)ev->pid);
+    else
+      info[0] = '\0';
+    char line[128];
+    snprintf(line, sizeof(line), "%10.6fs %+10.6fs  %-10s %s",
+             elapsed(&first->when, &ev->when), elapsed(&prev->when, &ev->when),
+             event_name[ev->type], info);
+    for (size_t n = strlen(line); n > 0 && line[n - 1] == ' '; n--)
+      line[n - 1] = '\0';
+    rio_printfb(out, "  %s\n", line);
+    prev = ev;
+  }
+}
+
+static double usec(const struct timespec *ts) {
+  return ts->tv_sec * 1e6 + ts->tv_nsec * 1e-3;
+}
+
+static event_t *forked(journal_t *journal, pid_t pid) {
+  event_t *ev;
+  foreach_event(ev, journal) {
+    if (ev->type == EV_FORKED && ev->pid == pid)
+      return ev;
+  }
+  return NULL;
+}
+
+/* Job becomes a process identified by its serial number. */
+static void chrome(FILE *f, int j, unsigned long serial, const char *command,
+                   journal_t *journal, bool *firstp) {
+  char name[MAXLINE], quoted[MAXLINE];
+  event_t *ev, *start;
+
+  snprintf(name, sizeof(name), "[%d] %s", j, command);
+  fprintf(f, "%s\n  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %lu, "
+             "\"args\": {\"name\": %s}}",
+          *firstp ? "" : ",", serial, jsonstr(quoted, sizeof(quoted), name));
+  *firstp = false;
+
+  foreach_event(ev, journal) {
+    fprintf(f, ",\n  {\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", "
+               "\"ts\": %.3f, \"pid\": %lu, \"tid\": %d, "
+               "\"args\": {\"status\": %d}}",
+            event_name[ev->type], usec(&ev->when), serial, (int)ev->pid,
+            ev->status);
+    if (ev->type != EV_EXITED)
+      continue;
+    /* Slice spanning life of the process, if its start was not dropped. */
+    if ((start = forked(journal, ev->pid)) == NULL)
+      continue;
+    fprintf(f, ",\n  {\"name\": \"process %d\", \"ph\": \"X\", \"ts\": %.3f, "
+               "\"dur\": %.3f, \"pid\": %lu, \"tid\": %d}",
+            (int)ev->pid, usec(&start->when),
+            usec(&ev->when) - usec(&start->when), serial, (int)ev->pid);
+  }
+}
+
+/* Display or dump journals of jobs. Call with SIGCHLD blocked. */
+int timeline(const char *path) {
+  unsigned first = nhistory > NHISTORY ? nhistory - NHISTORY : 0;
+
+  if (path == NULL) {
+    rio_writer_t out;
+    rio_writeinitb(&out, STDERR_FILENO);
+    for (unsigned i = first; i < nhistory; i++) {
+      history_t *h = &history[i % NHISTORY];
+      show(&out, h->job, h->command, &h->journal, "finished");
+    }
+    static const char *state_name[] = {
+      [FINISHED] = "finished", [RUNNING] = "running", [STOPPED] = "suspended",
+      [QUEUED] = "queued"};
+    for (int j = BG; j < njobmax; j++)
+      if (jobs[j].pgid)
+        show(&out, j, jobs[j].command, &jobs[j].journal,
+             state_name[jobs[j].state]);
+    rio_flushb(&out);
+    return 0;
+  }
+
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    msg("jobs: %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  bool firstev = true;
+  fprintf(f, "{\"traceEvents\": [");
+  for (unsigned i = first; i < nhistory; i++) {
+    history_t *h = &history[i % NHISTORY];
+    chrome(f, h->job, h->serial, h->command, &h->journal, &firstev);
+  }
+  for (int j = BG; j < njobmax; j++)
+    if (jobs[j].pgid)
+      chrome(f, j, jobs[j].serial, jobs[j].command, &jobs[j].journal,
+             &firstev);
+  fprintf(f, "\n], \"displayTimeUnit\": \"ms\"}\n");
+
+  if (fclose(f)) {
+    msg("jobs: %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
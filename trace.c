@@ -3,13 +3,40 @@
 
 #define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <termios.h>
 #include <dlfcn.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/*
+ * By default every intercepted call is formatted and written to standard
+ * error right away. That distorts timing, so with TRACE_RING=path calls are
+ * stored as fixed-size binary records in a ring kept in a memory mapped file
+ * shared by all traced processes. `tracedump path` decodes the ring into the
+ * same text format offline. TRACE_SIZE sets the number of records in a new
+ * ring (65536 by default).
+ *
+ * TRACE_FILTER=call,... traces only listed calls, TRACE_FILTER=-call,...
+ * traces all but listed calls.
+ *
+ * Every traced call is timed and accounted in a per-call histogram of
+ * latencies. With TRACE_HIST=path histograms are appended to the file when
+ * the process exits or replaces its image with execve.
+ */
 
 static int (*execve_p)(const char *path, char *const argv[],
                        char *const envp[]) = NULL;
@@ -22,6 +49,23 @@ static int (*setpgid_p)(pid_t pid, pid_t pgid) = NULL;
 static int (*tcsetpgrp_p)(int fd, pid_t pgrp);
 static int (*tcsetattr_p)(int fd, int action, const struct termios *t);
 static int (*kill_p)(pid_t pid, int sig);
+static pid_t (*vfork_p)(void) __attribute__((used));
+static int (*clone_p)(int (*fn)(void *), void *stack, int flags, void *arg,
+                      ...);
+static int (*posix_spawn_p)(pid_t *pid, const char *path,
+                            const posix_spawn_file_actions_t *actions,
+                            const posix_spawnattr_t *attr, char *const argv[],
+                            char *const envp[]);
+static int (*posix_spawnp_p)(pid_t *pid, const char *file,
+                             const posix_spawn_file_actions_t *actions,
+                             const posix_spawnattr_t *attr, char *const argv[],
+                             char *const envp[]);
+static int (*pipe_p)(int fds[2]);
+static int (*pipe2_p)(int fds[2], int flags);
+static int (*dup3_p)(int oldfd, int newfd, int flags);
+static int (*tcgetattr_p)(int fd, struct termios *t);
+static int (*waitid_p)(idtype_t idtype, id_t id, siginfo_t *infop,
+                       int options);
 
 static void xdlsym(const char *symbol, void **fn_p) {
   if (*fn_p == NULL) {
@@ -35,114 +79,469 @@ static void xdlsym(const char *symbol, void **fn_p) {
 }
 
 #define LINESZ 256
+#define RINGSIZE 65536
+
+static unsigned filter = ~0U;   /* bit set of traced calls */
+static trace_hdr_t *ring;       /* NULL if records are written as text */
+static trace_rec_t *records;    /* `ring->size` records following header */
+static pid_t mypid;             /* cached identity, 0 if unknown */
+static int sharedvm;            /* > 0 if memory is shared with a child */
+static const char *histpath;    /* where to append histograms */
+static trace_hist_t hist[NTRACECALLS];
+
+static void setfilter(const char *spec) {
+  bool exclude = *spec == '-';
+  unsigned mask = 0;
+
+  for (spec += exclude; *spec; spec += *spec == ',') {
+    size_t len = strcspn(spec, ",");
+    for (int i = 0; i < NTRACECALLS; i++)
+      if (strlen(trace_call[i]) == len && !strncmp(spec, trace_call[i], len))
+        mask |= 1U << i;
+    spec += len;
+  }
+
+  filter = exclude ? ~mask : mask;
+}
+
+/* Map the ring shared with other traced processes, creating it if needed.
+ * Creator sets the magic last, others wait for it before using the ring. */
+static void mapring(const char *path) {
+  const char *sizestr = getenv("TRACE_SIZE");
+  uint32_t size = RINGSIZE;
+  struct stat st;
+
+  if (sizestr && atol(sizestr) > 0)
+    for (size = 1; size < (uint32_t)atol(sizestr); size <<= 1)
+      ;
+
+  xdlsym("open", (void **)&open_p);
+  xdlsym("close", (void **)&close_p);
+
+  int fd = open_p(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  bool creator = fd >= 0;
+  if (!creator)
+    fd = open_p(path, O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0)
+    return;
+
+  if (creator) {
+    if (ftruncate(fd, sizeof(trace_hdr_t) + size * sizeof(trace_rec_t)) < 0)
+      goto fail;
+  } else {
+    for (int i = 0; fstat(fd, &st) == 0 && st.st_size == 0; i++) {
+      if (i == 1000)
+        goto fail;
+      sched_yield();
+    }
+  }
+
+  trace_hdr_t *hdr =
+    mmap(NULL, sizeof(trace_hdr_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (hdr == MAP_FAILED)
+    goto fail;
+
+  if (creator) {
+    hdr->size = size;
+    hdr->recsize = sizeof(trace_rec_t);
+    uint64_t magic;
+    memcpy(&magic, TRACE_MAGIC, sizeof(magic));
+    __atomic_store_n((uint64_t *)hdr->magic, magic, __ATOMIC_RELEASE);
+  }
+
+  for (int i = 0; memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)); i++) {
+    if (i == 1000)
+      goto unmap;
+    sched_yield();
+  }
+
+  size = hdr->size;
+  if (hdr->recsize != sizeof(trace_rec_t) || (size & (size - 1)))
+    goto unmap;
+  munmap(hdr, sizeof(trace_hdr_t));
+
+  ring = mmap(NULL, sizeof(trace_hdr_t) + size * sizeof(trace_rec_t),
+              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ring == MAP_FAILED)
+    ring = NULL;
+  else
+    records = (trace_rec_t *)(ring + 1);
+  close_p(fd);
+  return;
+
+unmap:
+  munmap(hdr, sizeof(trace_hdr_t));
+fail:
+  close_p(fd);
+}
+
+static __attribute__((constructor)) void trace_init(void) {
+  const char *spec = getenv("TRACE_FILTER");
+  const char *path = getenv("TRACE_RING");
+
+  histpath = getenv("TRACE_HIST");
+  if (spec)
+    setfilter(spec);
+  if (path)
+    mapring(path);
+}
+
+/* Append histograms of calls made since start or last dump to a file. */
+static void dumphist(void) {
+  static char buf[16384];
+
+  if (histpath == NULL)
+    return;
+
+  int saved = errno;
+  size_t n = snprintf(buf, sizeof(buf), "# pid %d (%s)\n", (int)getpid(),
+                      program_invocation_short_name);
+  size_t empty = n;
+  for (int i = 0; i < NTRACECALLS && n < sizeof(buf); i++)
+    if (hist[i].count)
+      n += trace_hist_format(i, &hist[i], buf + n, sizeof(buf) - n);
+  if (n == empty) {
+    errno = saved;
+    return;
+  }
+  if (n > sizeof(buf))
+    n = sizeof(buf);
+
+  xdlsym("open", (void **)&open_p);
+  xdlsym("close", (void **)&close_p);
+  int fd = open_p(histpath, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    if (write(fd, buf, n) < 0)
+      ; /* nothing sensible to do */
+    close_p(fd);
+  }
+  memset(hist, 0, sizeof(hist));
+  errno = saved;
+}
+
+static __attribute__((destructor)) void trace_fini(void) {
+  dumphist();
+}
+
+static inline bool traced(int call) {
+  return filter & (1U << call);
+}
+
+static inline uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Process identifier is looked up once and forgotten in a new child. A child
+ * that shares memory with us would overwrite the cache, so then it is not used
+ * at all. Process group is not cached: it changes with setsid, setpgrp or
+ * setpgid called by our parent, none of which we see. */
+static void identify(trace_rec_t *r) {
+  if (sharedvm)
+    r->pid = getpid();
+  else {
+    if (mypid == 0)
+      mypid = getpid();
+    r->pid = mypid;
+  }
+  r->pgid = getpgrp();
+}
+
+static void report(int call, uint64_t start, uint64_t duration, int result,
+                   int64_t arg0, int64_t arg1, int64_t arg2,
+                   const char *path) {
+  trace_rec_t rec, *r = &rec;
+  uint64_t seq = 0;
+
+  if (ring) {
+    seq = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    r = &records[seq & (ring->size - 1)];
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+  }
+
+  r->time = start;
+  r->duration = duration;
+  identify(r);
+  r->call = call;
+  r->result = result;
+  r->arg[0] = arg0;
+  r->arg[1] = arg1;
+  r->arg[2] = arg2;
+  r->path[0] = '\0';
+  if (path)
+    strncat(r->path, path, TRACE_PATHLEN - 1);
+
+  if (ring) {
+    __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELEASE);
+    return;
+  }
 
-static __attribute__((format(printf, 1, 2))) void report(const char *fmt, ...) {
   char line[LINESZ];
-  int n = 0;
-  va_list args;
-  va_start(args, fmt);
-  n += snprintf(line + n, LINESZ - n, "[%d:%d] ", getpid(), getpgrp());
-  n += vsnprintf(line + n, LINESZ - n, fmt, args);
+  int n = trace_format(r, line, LINESZ);
   assert(n < LINESZ); /* Need one character to terminate string! */
   line[n++] = '\n';
-  va_end(args);
   int m = write(STDERR_FILENO, line, n);
   assert(m == n); /* Fail if write was not atomic! */
 }
 
+/* Account and report a call that started at `start` if it is traced. */
+static void done(int call, uint64_t start, int result, int64_t arg0,
+                 int64_t arg1, int64_t arg2, const char *path) {
+  if (!traced(call))
+    return;
+  int saved = errno;
+  uint64_t duration = now() - start;
+  trace_account(&hist[call], duration);
+  report(call, start, duration, result, arg0, arg1, arg2, path);
+  errno = saved;
+}
+
 int execve(const char *path, char *const argv[], char *const envp[]) {
   xdlsym("execve", (void **)&execve_p);
-  report("execve(\"%s\", %p, %p)", path, argv, envp);
-  return execve_p(path, argv, envp);
+  uint64_t start = now();
+  if (traced(TR_EXECVE))
+    report(TR_EXECVE, start, 0, 0, (intptr_t)argv, (intptr_t)envp, 0, path);
+  /* Histograms would be lost with the image, unless they belong to parent. */
+  if (!sharedvm)
+    dumphist();
+  int res = execve_p(path, argv, envp);
+  if (traced(TR_EXECVE))
+    trace_account(&hist[TR_EXECVE], now() - start);
+  return res;
 }
 
 int fork(void) {
   xdlsym("fork", (void **)&fork_p);
+  uint64_t start = now();
   pid_t child = fork_p();
-  if (child)
-    report("fork() = %d", child);
+  if (child == 0) {
+    mypid = 0;
+    memset(hist, 0, sizeof(hist));
+  } else {
+    done(TR_FORK, start, child, 0, 0, 0, NULL);
+  }
   return child;
 }
 
-#define _SN(x) [x] = #x
+#ifdef __x86_64__
+/*
+ * vfork child returns from the function that called vfork, then the parent
+ * returns from it again, possibly with the stack frame clobbered by the child.
+ * So the wrapper must not have a frame of its own: it keeps the return address
+ * in a variable (the same for both processes) and calls the real vfork with
+ * the stack pointer just as the caller left it. Duration of the call includes
+ * the time till the child called execve or exited. Not thread-safe.
+ */
+static void *vfork_return __attribute__((used));
+static uint64_t vfork_start;
+
+static __attribute__((used)) void vfork_enter(void) {
+  xdlsym("vfork", (void **)&vfork_p);
+  sharedvm++;
+  vfork_start = now();
+}
+
+static __attribute__((used)) pid_t vfork_leave(pid_t child) {
+  sharedvm--;
+  done(TR_VFORK, vfork_start, child, 0, 0, 0, NULL);
+  return child;
+}
+
+asm(".text\n"
+    ".globl vfork\n"
+    ".type vfork, @function\n"
+    "vfork:\n"
+    "  popq vfork_return(%rip)\n"
+    "  call vfork_enter\n"
+    "  call *vfork_p(%rip)\n"
+    "  testl %eax, %eax\n"
+    "  jz 1f\n"
+    "  movl %eax, %edi\n"
+    "  call vfork_leave\n"
+    "1:\n"
+    "  jmp *vfork_return(%rip)\n"
+    ".size vfork, .-vfork\n");
+#endif
+
+typedef struct clone_start {
+  int (*fn)(void *);
+  void *arg;
+} clone_start_t;
+
+/* A child with memory of its own starts afresh, as after fork. */
+static int clone_child(void *arg) {
+  clone_start_t *start = arg;
+  mypid = 0;
+  memset(hist, 0, sizeof(hist));
+  return start->fn(start->arg);
+}
+
+/* Arguments that follow `arg` are read unconditionally, as glibc does. */
+int clone(int (*fn)(void *), void *stack, int flags, void *arg, ...) {
+  va_list ap;
+  va_start(ap, arg);
+  pid_t *ptid = va_arg(ap, pid_t *);
+  void *tls = va_arg(ap, void *);
+  pid_t *ctid = va_arg(ap, pid_t *);
+  va_end(ap);
+
+  xdlsym("clone", (void **)&clone_p);
+  /* A child that shares memory but is not a thread has an identity of its own.
+   * Unless the child is vfork-like, we cannot tell when it stops sharing. */
+  bool shared = (flags & CLONE_VM) && !(flags & CLONE_THREAD);
+  if (shared)
+    sharedvm++;
+  mypid = 0;
+  /* The child gets a copy of our stack, so it finds `child` there. */
+  clone_start_t child = {fn, arg};
+  if (!(flags & CLONE_VM)) {
+    fn = clone_child;
+    arg = &child;
+  }
+  uint64_t start = now();
+  int res = clone_p(fn, stack, flags, arg, ptid, tls, ctid);
+  if (shared && (flags & CLONE_VFORK))
+    sharedvm--;
+  done(TR_CLONE, start, res, (intptr_t)child.fn, flags, 0, NULL);
+  return res;
+}
 
-static const char *signame[NSIG] = {
-  _SN(SIGHUP),  _SN(SIGINT),  _SN(SIGQUIT), _SN(SIGILL),  _SN(SIGTRAP),
-  _SN(SIGABRT), _SN(SIGFPE),  _SN(SIGKILL), _SN(SIGBUS),  _SN(SIGSYS),
-  _SN(SIGSEGV), _SN(SIGPIPE), _SN(SIGALRM), _SN(SIGTERM), _SN(SIGURG),
-  _SN(SIGSTOP), _SN(SIGTSTP), _SN(SIGCONT), _SN(SIGCHLD), _SN(SIGTTIN),
-  _SN(SIGTTOU), _SN(SIGPOLL), _SN(SIGXCPU), _SN(SIGXFSZ), _SN(SIGVTALRM),
-  _SN(SIGPROF), _SN(SIGUSR1), _SN(SIGUSR2), _SN(SIGWINCH)};
+int posix_spawn(pid_t *pid, const char *path,
+                const posix_spawn_file_actions_t *actions,
+                const posix_spawnattr_t *attr, char *const argv[],
+                char *const envp[]) {
+  xdlsym("posix_spawn", (void **)&posix_spawn_p);
+  uint64_t start = now();
+  int res = posix_spawn_p(pid, path, actions, attr, argv, envp);
+  done(TR_POSIX_SPAWN, start, res, res == 0 && pid ? *pid : -1,
+       (intptr_t)argv, (intptr_t)envp, path);
+  return res;
+}
 
-#undef _SN
+int posix_spawnp(pid_t *pid, const char *file,
+                 const posix_spawn_file_actions_t *actions,
+                 const posix_spawnattr_t *attr, char *const argv[],
+                 char *const envp[]) {
+  xdlsym("posix_spawnp", (void **)&posix_spawnp_p);
+  uint64_t start = now();
+  int res = posix_spawnp_p(pid, file, actions, attr, argv, envp);
+  done(TR_POSIX_SPAWNP, start, res, res == 0 && pid ? *pid : -1,
+       (intptr_t)argv, (intptr_t)envp, file);
+  return res;
+}
 
 pid_t waitpid(pid_t pid, int *statusp, int options) {
-  int status;
+  int status = 0;
   xdlsym("waitpid", (void **)&waitpid_p);
+  uint64_t start = now();
   pid = waitpid_p(pid, &status, options);
-  if (pid <= 0) {
-    report("waitpid(...) -> {}");
-  } else if (WIFCONTINUED(status)) {
-    report("waitpid(...) -> {pid=%d, status=SIGCONT}", pid);
-  } else if (WIFSTOPPED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%s}", pid,
-           signame[WSTOPSIG(status)]);
-  } else if (WIFSIGNALED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%s}", pid,
-           signame[WTERMSIG(status)]);
-  } else if (WIFEXITED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%d}", pid, WEXITSTATUS(status));
-  }
+  done(TR_WAITPID, start, pid, 0, status, 0, NULL);
   if (statusp)
     *statusp = status;
   return pid;
 }
 
-int open(const char *pathname, int flags, mode_t mode) {
+int waitid(idtype_t idtype, id_t id, siginfo_t *infop, int options) {
+  xdlsym("waitid", (void **)&waitid_p);
+  uint64_t start = now();
+  int res = waitid_p(idtype, id, infop, options);
+  done(TR_WAITID, start, res, idtype, id, options, NULL);
+  return res;
+}
+
+int open(const char *pathname, int flags, ...) {
+  mode_t mode = 0;
+  if (__OPEN_NEEDS_MODE(flags)) {
+    va_list ap;
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+  }
   xdlsym("open", (void **)&open_p);
+  uint64_t start = now();
   int res = open_p(pathname, flags, mode);
-  report("open(\"%s\", %d, %d) = %d", pathname, flags, mode, res);
+  done(TR_OPEN, start, res, flags, mode, 0, pathname);
   return res;
 }
 
 int close(int fd) {
   xdlsym("close", (void **)&close_p);
+  uint64_t start = now();
   int res = close_p(fd);
-  report("close(%d) = %d", fd, res);
+  done(TR_CLOSE, start, res, fd, 0, 0, NULL);
+  return res;
+}
+
+int pipe(int fds[2]) {
+  xdlsym("pipe", (void **)&pipe_p);
+  uint64_t start = now();
+  int res = pipe_p(fds);
+  done(TR_PIPE, start, res, res ? -1 : fds[0], res ? -1 : fds[1], 0, NULL);
+  return res;
+}
+
+int pipe2(int fds[2], int flags) {
+  xdlsym("pipe2", (void **)&pipe2_p);
+  uint64_t start = now();
+  int res = pipe2_p(fds, flags);
+  done(TR_PIPE2, start, res, res ? -1 : fds[0], res ? -1 : fds[1], flags,
+       NULL);
   return res;
 }
 
 int dup2(int oldfd, int newfd) {
   xdlsym("dup2", (void **)&dup2_p);
+  uint64_t start = now();
   int res = dup2_p(oldfd, newfd);
-  report("dup2(%d, %d) = %d", oldfd, newfd, res);
+  done(TR_DUP2, start, res, oldfd, newfd, 0, NULL);
+  return res;
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+  xdlsym("dup3", (void **)&dup3_p);
+  uint64_t start = now();
+  int res = dup3_p(oldfd, newfd, flags);
+  done(TR_DUP3, start, res, oldfd, newfd, flags, NULL);
   return res;
 }
 
 int setpgid(pid_t pid, pid_t pgid) {
   xdlsym("setpgid", (void **)&setpgid_p);
+  uint64_t start = now();
   int res = setpgid_p(pid, pgid);
-  report("setpgid(%d, %d) = %d", pid, pgid, res);
+  done(TR_SETPGID, start, res, pid, pgid, 0, NULL);
   return res;
 }
 
 int kill(pid_t pid, int sig) {
   xdlsym("kill", (void **)&kill_p);
+  uint64_t start = now();
   int res = kill_p(pid, sig);
-  report("kill(%d, %s) = %d", pid, signame[sig], res);
+  done(TR_KILL, start, res, pid, sig, 0, NULL);
   return res;
 }
 
 int tcsetpgrp(int fd, pid_t pgrp) {
   xdlsym("tcsetpgrp", (void **)&tcsetpgrp_p);
+  uint64_t start = now();
   int res = tcsetpgrp_p(fd, pgrp);
-  report("tcsetpgrp(%d, %d) = %d", fd, pgrp, res);
+  done(TR_TCSETPGRP, start, res, fd, pgrp, 0, NULL);
+  return res;
+}
+
+int tcgetattr(int fd, struct termios *t) {
+  xdlsym("tcgetattr", (void **)&tcgetattr_p);
+  uint64_t start = now();
+  int res = tcgetattr_p(fd, t);
+  done(TR_TCGETATTR, start, res, fd, (intptr_t)t, 0, NULL);
   return res;
 }
 
 int tcsetattr(int fd, int action, const struct termios *t) {
   xdlsym("tcsetattr", (void **)&tcsetattr_p);
+  uint64_t start = now();
   int res = tcsetattr_p(fd, action, t);
-  report("tcsetattr(%d, %d, %p) = %d", fd, action, t, res);
+  done(TR_TCSETATTR, start, res, fd, action, (intptr_t)t, NULL);
   return res;
 }
@@ -0,0 +1,246 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/* Records of calls intercepted by trace.so, shared with tracedump decoder. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+enum {
+  TR_EXECVE,
+  TR_FORK,
+  TR_WAITPID,
+  TR_OPEN,
+  TR_CLOSE,
+  TR_DUP2,
+  TR_SETPGID,
+  TR_KILL,
+  TR_TCSETPGRP,
+  TR_TCSETATTR,
+  TR_VFORK,
+  TR_CLONE,
+  TR_POSIX_SPAWN,
+  TR_POSIX_SPAWNP,
+  TR_PIPE,
+  TR_PIPE2,
+  TR_DUP3,
+  TR_TCGETATTR,
+  TR_WAITID,
+  NTRACECALLS,
+};
+
+static __attribute__((unused)) const char *trace_call[NTRACECALLS] = {
+  [TR_EXECVE] = "execve",       [TR_FORK] = "fork",
+  [TR_WAITPID] = "waitpid",     [TR_OPEN] = "open",
+  [TR_CLOSE] = "close",         [TR_DUP2] = "dup2",
+  [TR_SETPGID] = "setpgid",     [TR_KILL] = "kill",
+  [TR_TCSETPGRP] = "tcsetpgrp", [TR_TCSETATTR] = "tcsetattr",
+  [TR_VFORK] = "vfork",         [TR_CLONE] = "clone",
+  [TR_POSIX_SPAWN] = "posix_spawn", [TR_POSIX_SPAWNP] = "posix_spawnp",
+  [TR_PIPE] = "pipe",           [TR_PIPE2] = "pipe2",
+  [TR_DUP3] = "dup3",           [TR_TCGETATTR] = "tcgetattr",
+  [TR_WAITID] = "waitid",
+};
+
+#define TRACE_MAGIC "SHTRACE2"
+#define TRACE_PATHLEN 56
+
+/* Fixed-size record of a single call. */
+typedef struct trace_rec {
+  uint64_t seq;              /* 1 + position in the ring, 0 while written */
+  uint64_t time;             /* CLOCK_MONOTONIC in nanoseconds */
+  uint64_t duration;         /* time spent in the call in nanoseconds */
+  int32_t pid, pgid;         /* caller */
+  int32_t call;              /* one of TR_* */
+  int32_t result;            /* return value */
+  int64_t arg[3];            /* integer and pointer arguments */
+  char path[TRACE_PATHLEN];  /* path argument, possibly truncated */
+} trace_rec_t;
+
+/* Ring file starts with a header followed by `size` records. Any process may
+ * append a record by incrementing `head`, so records are ordered by `seq`. */
+typedef struct trace_hdr {
+  char magic[8];    /* TRACE_MAGIC, set once the ring is initialized */
+  uint32_t size;    /* number of records, a power of two */
+  uint32_t recsize; /* sizeof(trace_rec_t) */
+  uint64_t head;    /* number of records ever reserved */
+  char pad[40];
+} trace_hdr_t;
+
+#define _SN(x) [x] = #x
+
+static const char *trace_signame[NSIG] = {
+  _SN(SIGHUP),  _SN(SIGINT),  _SN(SIGQUIT), _SN(SIGILL),  _SN(SIGTRAP),
+  _SN(SIGABRT), _SN(SIGFPE),  _SN(SIGKILL), _SN(SIGBUS),  _SN(SIGSYS),
+  _SN(SIGSEGV), _SN(SIGPIPE), _SN(SIGALRM), _SN(SIGTERM), _SN(SIGURG),
+  _SN(SIGSTOP), _SN(SIGTSTP), _SN(SIGCONT), _SN(SIGCHLD), _SN(SIGTTIN),
+  _SN(SIGTTOU), _SN(SIGPOLL), _SN(SIGXCPU), _SN(SIGXFSZ), _SN(SIGVTALRM),
+  _SN(SIGPROF), _SN(SIGUSR1), _SN(SIGUSR2), _SN(SIGWINCH)};
+
+#undef _SN
+
+static inline const char *trace_sig(int64_t sig) {
+  const char *name = sig >= 0 && sig < NSIG ? trace_signame[sig] : NULL;
+  return name ? name : "(null)";
+}
+
+/* Format a record as a line of text (without newline). Returns its length. */
+static inline int trace_format(const trace_rec_t *r, char *buf, size_t size) {
+  int n = snprintf(buf, size, "[%d:%d] ", r->pid, r->pgid);
+  char *s = buf + n;
+  size_t left = size - n;
+  int res = r->result, st = r->arg[1];
+
+  switch (r->call) {
+    case TR_EXECVE:
+      n += snprintf(s, left, "execve(\"%s\", %p, %p)", r->path,
+                    (void *)(intptr_t)r->arg[0], (void *)(intptr_t)r->arg[1]);
+      break;
+    case TR_FORK:
+      n += snprintf(s, left, "fork() = %d", res);
+      break;
+    case TR_WAITPID:
+      if (res <= 0)
+        n += snprintf(s, left, "waitpid(...) -> {}");
+      else if (WIFCONTINUED(st))
+        n += snprintf(s, left, "waitpid(...) -> {pid=%d, status=SIGCONT}", res);
+      else if (WIFSTOPPED(st))
+        n += snprintf(s, left, "waitpid(...) -> {pid=%d, status=%s}", res,
+                      trace_sig(WSTOPSIG(st)));
+      else if (WIFSIGNALED(st))
+        n += snprintf(s, left, "waitpid(...) -> {pid=%d, status=%s}", res,
+                      trace_sig(WTERMSIG(st)));
+      else
+        n += snprintf(s, left, "waitpid(...) -> {pid=%d, status=%d}", res,
+                      WEXITSTATUS(st));
+      break;
+    case TR_OPEN:
+      n += snprintf(s, left, "open(\"%s\", %d, %d) = %d", r->path,
+                    (int)r->arg[0], (int)r->arg[1], res);
+      break;
+    case TR_CLOSE:
+      n += snprintf(s, left, "close(%d) = %d", (int)r->arg[0], res);
+      break;
+    case TR_DUP2:
+      n += snprintf(s, left, "dup2(%d, %d) = %d", (int)r->arg[0],
+                    (int)r->arg[1], res);
+      break;
+    case TR_SETPGID:
+      n += snprintf(s, left, "setpgid(%d, %d) = %d", (int)r->arg[0],
+                    (int)r->arg[1], res);
+      break;
+    case TR_KILL:
+      n += snprintf(s, left, "kill(%d, %s) = %d", (int)r->arg[0],
+                    trace_sig(r->arg[1]), res);
+      break;
+    case TR_TCSETPGRP:
+      n += snprintf(s, left, "tcsetpgrp(%d, %d) = %d", (int)r->arg[0],
+                    (int)r->arg[1], res);
+      break;
+    case TR_TCSETATTR:
+      n += snprintf(s, left, "tcsetattr(%d, %d, %p) = %d", (int)r->arg[0],
+                    (int)r->arg[1], (void *)(intptr_t)r->arg[2], res);
+      break;
+    case TR_VFORK:
+      n += snprintf(s, left, "vfork() = %d", res);
+      break;
+    case TR_CLONE:
+      n += snprintf(s, left, "clone(%p, %#x) = %d", (void *)(intptr_t)r->arg[0],
+                    (unsigned)r->arg[1], res);
+      break;
+    case TR_POSIX_SPAWN:
+    case TR_POSIX_SPAWNP:
+      n += snprintf(s, left, "%s(%d, \"%s\", %p, %p) = %d",
+                    r->call == TR_POSIX_SPAWN ? "posix_spawn" : "posix_spawnp",
+                    (int)r->arg[0], r->path, (void *)(intptr_t)r->arg[1],
+                    (void *)(intptr_t)r->arg[2], res);
+      break;
+    case TR_PIPE:
+      n += snprintf(s, left, "pipe(%d, %d) = %d", (int)r->arg[0],
+                    (int)r->arg[1], res);
+      break;
+    case TR_PIPE2:
+      n += snprintf(s, left, "pipe2(%d, %d, %d) = %d", (int)r->arg[0],
+                    (int)r->arg[1], (int)r->arg[2], res);
+      break;
+    case TR_DUP3:
+      n += snprintf(s, left, "dup3(%d, %d, %d) = %d", (int)r->arg[0],
+                    (int)r->arg[1], (int)r->arg[2], res);
+      break;
+    case TR_TCGETATTR:
+      n += snprintf(s, left, "tcgetattr(%d, %p) = %d", (int)r->arg[0],
+                    (void *)(intptr_t)r->arg[1], res);
+      break;
+    case TR_WAITID:
+      n += snprintf(s, left, "waitid(%d, %d, %d) = %d", (int)r->arg[0],
+                    (int)r->arg[1], (int)r->arg[2], res);
+      break;
+    default:
+      n += snprintf(s, left, "unknown call %d", r->call);
+  }
+
+  return n;
+}
+
+#define TRACE_NBUCKETS 32
+
+/* Latency histogram of a call. Bucket `i` counts calls that took from 2^i up
+ * to 2^(i+1) nanoseconds, the last one also all longer calls. */
+typedef struct trace_hist {
+  uint64_t count, total, max;
+  uint64_t bucket[TRACE_NBUCKETS];
+} trace_hist_t;
+
+static inline void trace_account(trace_hist_t *h, uint64_t ns) {
+  int i = ns ? 63 - __builtin_clzll(ns) : 0;
+  if (i >= TRACE_NBUCKETS)
+    i = TRACE_NBUCKETS - 1;
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->total, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->bucket[i], 1, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, true,
+                                                  __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED))
+    ;
+}
+
+static inline const char *trace_duration(char *buf, size_t size, uint64_t ns) {
+  if (ns < 1000)
+    snprintf(buf, size, "%uns", (unsigned)ns);
+  else if (ns < 1000000)
+    snprintf(buf, size, "%.3gus", ns * 1e-3);
+  else if (ns < 1000000000)
+    snprintf(buf, size, "%.3gms", ns * 1e-6);
+  else
+    snprintf(buf, size, "%.3gs", ns * 1e-9);
+  return buf;
+}
+
+/* Format histogram of a call as lines of text. Returns their length. */
+static inline int trace_hist_format(int call, const trace_hist_t *h, char *buf,
+                                    size_t size) {
+  char total[16], max[16], lo[16], hi[16];
+  size_t n = snprintf(buf, size, "%s: %lu calls, total %s, max %s\n",
+                      trace_call[call], (unsigned long)h->count,
+                      trace_duration(total, sizeof(total), h->total),
+                      trace_duration(max, sizeof(max), h->max));
+
+  for (int i = 0; i < TRACE_NBUCKETS && n < size; i++) {
+    if (h->bucket[i] == 0)
+      continue;
+    trace_duration(lo, sizeof(lo), i ? 1ULL << i : 0);
+    if (i < TRACE_NBUCKETS - 1)
+      trace_duration(hi, sizeof(hi), 2ULL << i);
+    else
+      snprintf(hi, sizeof(hi), "inf");
+    n += snprintf(buf + n, size - n, "  [%7s, %7s) %8lu\n", lo, hi,
+                  (unsigned long)h->bucket[i]);
+  }
+
+  return n;
+}
+
+#endif /* !_TRACE_H_ */
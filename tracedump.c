@@ -0,0 +1,334 @@
+#include "csapp.h"
+#include "trace.h"
+#include <stdarg.h>
+
+/*
+ * Decoder of binary traces recorded by trace.so with TRACE_RING=file:
+ *
+ *   tracedump [-t] [-l | -j] file
+ *
+ * Records are printed in the order they were made, in the same format trace.so
+ * uses when it writes them as text. With `-t` every line is prefixed with time
+ * in seconds since the first record and duration of the call. With `-l`
+ * latency histograms of calls made by all traced processes are printed
+ * instead of records.
+ *
+ * With `-j` the process tree is rebuilt from records of calls that create,
+ * replace and reap processes, and written in Chrome trace event format, to be
+ * opened with chrome://tracing or Perfetto. Every process group becomes
+ * a process, every process a thread with spans from fork to exec and from
+ * exec to exit. Flow arrows lead from parents to children, while terminal
+ * handoffs, signals sent, stops and continues are instant events.
+ */
+
+typedef struct {
+  pid_t pid, ppid, pgid;
+  uint64_t start, exec, end; /* 0 if not known */
+  bool reaped;
+  int status;
+  char name[TRACE_PATHLEN];
+} proc_t;
+
+typedef struct {
+  int proc;      /* index of process the event is displayed for */
+  uint64_t time;
+  bool global;   /* spans all tracks */
+  char name[64];
+} instant_t;
+
+static proc_t *procs;
+static int nprocs;
+static instant_t *instants;
+static int ninstants;
+
+/* Most recent process with given pid, or a new one if it was reaped. */
+static int process(pid_t pid, uint64_t time) {
+  for (int i = nprocs - 1; i >= 0; i--)
+    if (procs[i].pid == pid) {
+      if (!procs[i].reaped)
+        return i;
+      break;
+    }
+
+  procs = Realloc(procs, (nprocs + 1) * sizeof(proc_t));
+  proc_t *p = &procs[nprocs];
+  memset(p, 0, sizeof(proc_t));
+  p->pid = pid;
+  p->start = time;
+  return nprocs++;
+}
+
+/* Child process was created by call recorded in `r`. Records of the child may
+ * precede that of the call, since the parent makes it when the call returns. */
+static int child(trace_rec_t *r, pid_t pid) {
+  int i = process(pid, r->time);
+  procs[i].ppid = r->pid;
+  if (procs[i].pgid == 0)
+    procs[i].pgid = r->pgid;
+  procs[i].start = r->time;
+  return i;
+}
+
+static void instant(int proc, uint64_t time, bool global, const char *fmt,
+                    ...) {
+  va_list ap;
+  instant_t *ev = &instants[ninstants++];
+  ev->proc = proc;
+  ev->time = time;
+  ev->global = global;
+  va_start(ap, fmt);
+  vsnprintf(ev->name, sizeof(ev->name), fmt, ap);
+  va_end(ap);
+}
+
+static const char *name(proc_t *p) {
+  return p->name[0] ? p->name : "?";
+}
+
+static void setname(proc_t *p, const char *path) {
+  const char *base = strrchr(path, '/');
+  strcpy(p->name, base ? base + 1 : path);
+}
+
+static void rebuild(trace_rec_t *r) {
+  int self = process(r->pid, r->time);
+  procs[self].pgid = r->pgid;
+
+  switch (r->call) {
+    case TR_FORK:
+    case TR_VFORK:
+    case TR_CLONE:
+      if (r->result > 0)
+        child(r, r->result);
+      break;
+    case TR_POSIX_SPAWN:
+    case TR_POSIX_SPAWNP:
+      if (r->result == 0 && r->arg[0] > 0) {
+        proc_t *p = &procs[child(r, r->arg[0])];
+        p->exec = r->time;
+        setname(p, r->path);
+      }
+      break;
+    case TR_EXECVE:
+      procs[self].exec = r->time;
+      setname(&procs[self], r->path);
+      break;
+    case TR_WAITPID:
+      if (r->result > 0) {
+        int i = process(r->result, r->time);
+        int status = r->arg[1];
+        if (WIFSTOPPED(status))
+          instant(i, r->time + r->duration, false, "stopped by %s",
+                  trace_sig(WSTOPSIG(status)));
+        else if (WIFCONTINUED(status))
+          instant(i, r->time + r->duration, false, "continued");
+        else {
+          procs[i].end = r->time + r->duration;
+          procs[i].status = status;
+          procs[i].reaped = true;
+        }
+      }
+      break;
+    case TR_KILL:
+      instant(self, r->time, false, "kill(%d, %s)", (int)r->arg[0],
+              trace_sig(r->arg[1]));
+      break;
+    case TR_TCSETPGRP:
+      instant(self, r->time, true, "terminal to %d", (int)r->arg[1]);
+      break;
+  }
+}
+
+/* Start next element of event array. */
+static void event(void) {
+  static bool first = true;
+  printf(first ? "\n  " : ",\n  ");
+  first = false;
+}
+
+static double usec(uint64_t ns) {
+  return ns * 1e-3;
+}
+
+static void span(proc_t *p, const char *name, uint64_t from, uint64_t to) {
+  char quoted[MAXLINE];
+  event();
+  printf("{\"name\": %s, \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+         "\"pid\": %d, \"tid\": %d, \"args\": {\"ppid\": %d, \"status\": %d}}",
+         jsonstr(quoted, sizeof(quoted), name), usec(from), usec(to - from),
+         p->pgid, p->pid, p->ppid, p->status);
+}
+
+static void metadata(const char *what, pid_t pgid, pid_t pid,
+                     const char *name) {
+  char quoted[MAXLINE];
+  event();
+  printf("{\"name\": \"%s\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+         "\"args\": {\"name\": %s}}",
+         what, pgid, pid, jsonstr(quoted, sizeof(quoted), name));
+}
+
+static void chrome(uint64_t last) {
+  char title[TRACE_PATHLEN + 16];
+
+  printf("{\"traceEvents\": [");
+
+  for (int i = 0; i < nprocs; i++) {
+    proc_t *p = &procs[i];
+    bool named = false;
+
+    /* Name every process group once, after the process that leads it. */
+    for (int j = 0; j < i && !named; j++)
+      named = procs[j].pgid == p->pgid;
+    if (!named) {
+      proc_t *leader = p;
+      for (int j = i; j < nprocs; j++)
+        if (procs[j].pid == p->pgid)
+          leader = &procs[j];
+      snprintf(title, sizeof(title), "group %d %s", p->pgid, name(leader));
+      metadata("process_name", p->pgid, p->pid, title);
+    }
+
+    snprintf(title, sizeof(title), "%d %s", p->pid, name(p));
+    metadata("thread_name", p->pgid, p->pid, title);
+
+    uint64_t end = p->end ? p->end : last;
+    if (p->exec && p->ppid && p->exec > p->start)
+      span(p, "fork to exec", p->start, p->exec);
+    if (p->exec)
+      span(p, p->name, p->exec, end);
+    else
+      span(p, p->ppid ? "forked" : "running", p->start, end);
+
+    for (int j = i - 1; p->ppid && j >= 0; j--) {
+      if (procs[j].pid != p->ppid)
+        continue;
+      event();
+      printf("{\"name\": \"fork\", \"cat\": \"fork\", \"ph\": \"s\", "
+             "\"id\": %d, \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+             i, usec(p->start), procs[j].pgid, procs[j].pid);
+      event();
+      printf("{\"name\": \"fork\", \"cat\": \"fork\", \"ph\": \"f\", "
+             "\"bp\": \"e\", \"id\": %d, \"ts\": %.3f, \"pid\": %d, "
+             "\"tid\": %d}",
+             i, usec(p->start), p->pgid, p->pid);
+      break;
+    }
+  }
+
+  for (int i = 0; i < ninstants; i++) {
+    instant_t *ev = &instants[i];
+    proc_t *p = &procs[ev->proc];
+    char quoted[MAXLINE];
+    event();
+    printf("{\"name\": %s, \"ph\": \"i\", \"s\": \"%c\", \"ts\": %.3f, "
+           "\"pid\": %d, \"tid\": %d}",
+           jsonstr(quoted, sizeof(quoted), ev->name), ev->global ? 'g' : 't',
+           usec(ev->time), p->pgid, p->pid);
+  }
+
+  printf("\n], \"displayTimeUnit\": \"ms\"}\n");
+}
+
+int main(int argc, char *argv[]) {
+  static trace_hist_t hist[NTRACECALLS];
+  bool timestamps = false, latencies = false, json = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "tlj")) != -1) {
+    if (opt == 't')
+      timestamps = true;
+    else if (opt == 'l')
+      latencies = true;
+    else if (opt == 'j')
+      json = true;
+    else
+      goto usage;
+  }
+
+  if (optind != argc - 1 || (latencies && json))
+    goto usage;
+
+  struct stat st;
+  int fd = Open(argv[optind], O_RDONLY, 0);
+  Fstat(fd, &st);
+  if ((size_t)st.st_size < sizeof(trace_hdr_t))
+    app_error("%s: not a trace ring", argv[optind]);
+
+  trace_hdr_t *ring = Mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  Close(fd);
+
+  uint32_t size = ring->size;
+  if (memcmp(ring->magic, TRACE_MAGIC, sizeof(ring->magic)) ||
+      ring->recsize != sizeof(trace_rec_t) || (size & (size - 1)) ||
+      sizeof(trace_hdr_t) + size * sizeof(trace_rec_t) > (size_t)st.st_size)
+    app_error("%s: not a trace ring", argv[optind]);
+
+  trace_rec_t *records = (trace_rec_t *)(ring + 1);
+  uint64_t head = ring->head;
+  uint64_t first = head > size ? head - size : 0;
+  uint64_t start = 0, last = 0;
+  unsigned long skipped = 0;
+
+  if (first > 0)
+    fprintf(stderr, "tracedump: %lu oldest records were overwritten\n",
+            (unsigned long)first);
+
+  if (json)
+    instants = Malloc((head - first + 1) * sizeof(instant_t));
+
+  for (uint64_t seq = first; seq < head; seq++) {
+    trace_rec_t *r = &records[seq & (size - 1)];
+    char line[256];
+
+    /* Record is missing if its writer died or has not finished yet. */
+    if (r->seq != seq + 1) {
+      skipped++;
+      continue;
+    }
+
+    if (latencies) {
+      if (r->call >= 0 && r->call < NTRACECALLS)
+        trace_account(&hist[r->call], r->duration);
+      continue;
+    }
+
+    if (json) {
+      rebuild(r);
+      if (r->time + r->duration > last)
+        last = r->time + r->duration;
+      continue;
+    }
+
+    if (start == 0)
+      start = r->time;
+    if (timestamps)
+      printf("%12.6f %10.6f ", (r->time - start) * 1e-9, r->duration * 1e-9);
+    trace_format(r, line, sizeof(line));
+    puts(line);
+  }
+
+  for (int i = 0; latencies && i < NTRACECALLS; i++) {
+    char text[4096];
+    if (hist[i].count) {
+      trace_hist_format(i, &hist[i], text, sizeof(text));
+      fputs(text, stdout);
+    }
+  }
+
+  if (json) {
+    chrome(last);
+    free(procs);
+    free(instants);
+  }
+
+  if (skipped)
+    fprintf(stderr, "tracedump: %lu incomplete records skipped\n", skipped);
+
+  Munmap(ring, st.st_size);
+  return EXIT_SUCCESS;
+
+usage:
+  fprintf(stderr, "usage: %s [-t] [-l | -j] file\n", argv[0]);
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,205 @@
+#include "csapp.h"
+#include "rio.h"
+#include "uring.h"
+#include "benchmark.h"
+#include <dirent.h>
+
+/*
+ * Benchmark of batched I/O against plain system calls:
+ *
+ *   uringbench [-n repeats] [-d directory] [file]
+ *
+ * First every entry of `directory` (/usr/bin by default) is probed with
+ * statx, as a shell does while searching PATH: one system call at a time and
+ * then in batches submitted through io_uring. Then the file, or 16MiB of
+ * generated data if none is given, is read in 64KiB blocks with rio_readnb
+ * and with batches of positioned reads. Rate of each method is printed
+ * together with a checksum of results, which must be the same for both.
+ *
+ * If io_uring is not available batches are carried out with plain system
+ * calls and both methods are expected to perform the same.
+ */
+
+#define ENTRIES 64
+#define BLKSIZE 65536
+
+/* Names of all entries of a directory, in a NULL terminated array. */
+static char **listdir(const char *path, int *countp) {
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    unix_error("opendir error");
+
+  int n = 0, size = 16;
+  char **names = Malloc(size * sizeof(char *));
+  for (struct dirent *de; (de = readdir(dir));) {
+    if (n + 1 == size)
+      names = Realloc(names, (size *= 2) * sizeof(char *));
+    names[n++] = strdup(de->d_name);
+  }
+  names[n] = NULL;
+  closedir(dir);
+  *countp = n;
+  return names;
+}
+
+static void checkstat(result_t *res, ssize_t rc, struct statx *stx) {
+  res->count++;
+  if (rc == 0)
+    res->sum += stx->stx_size + stx->stx_mode;
+}
+
+static result_t probe_ring(uring_t *ring, int dirfd, char **names, int n) {
+  uring_req_t *req = Calloc(n, sizeof(uring_req_t));
+  struct statx *stx = Calloc(n, sizeof(struct statx));
+  result_t res = {0, 0};
+
+  for (int i = 0; i < n; i++)
+    req[i] = (uring_req_t){.op = URING_STATX, .fd = dirfd, .path = names[i],
+                           .buf = &stx[i]};
+  uring_run(ring, req, n);
+  for (int i = 0; i < n; i++)
+    checkstat(&res, req[i].result, &stx[i]);
+
+  free(stx);
+  free(req);
+  return res;
+}
+
+static result_t read_rio(int fd) {
+  static char buf[BLKSIZE];
+  result_t res = {0, 0};
+  rio_t rio;
+  ssize_t n;
+
+  Lseek(fd, 0, SEEK_SET);
+  rio_readinitb(&rio, fd);
+  while ((n = Rio_readnb(&rio, buf, sizeof(buf))) > 0) {
+    res.count += n;
+    for (ssize_t i = 0; i < n; i++)
+      res.sum = res.sum * 31 + (unsigned char)buf[i];
+  }
+  return res;
+}
+
+static result_t read_ring(uring_t *ring, int fd, off_t size) {
+  static char buf[ENTRIES][BLKSIZE];
+  uring_req_t req[ENTRIES];
+  result_t res = {0, 0};
+
+  for (off_t off = 0; off < size; off += ENTRIES * BLKSIZE) {
+    int n = 0;
+    for (; n < ENTRIES && off + n * BLKSIZE < size; n++)
+      req[n] = (uring_req_t){.op = URING_READ, .fd = fd, .buf = buf[n],
+                             .len = BLKSIZE, .off = off + n * BLKSIZE};
+    if (uring_run(ring, req, n))
+      unix_error("read error");
+    for (int j = 0; j < n; j++) {
+      res.count += req[j].result;
+      for (ssize_t i = 0; i < req[j].result; i++)
+        res.sum = res.sum * 31 + (unsigned char)buf[j][i];
+    }
+  }
+  return res;
+}
+
+/* Fill a temporary file with 16MiB of pseudo-random bytes. */
+static int generate(void) {
+  char path[] = "/tmp/uringbench.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    unix_error("mkstemp error");
+  Unlink(path);
+
+  static char buf[BLKSIZE];
+  srandom(1);
+  for (int i = 0; i < (16 << 20) / BLKSIZE; i++) {
+    for (size_t j = 0; j < sizeof(buf); j++)
+      buf[j] = random();
+    Rio_writen(fd, buf, sizeof(buf));
+  }
+  return fd;
+}
+
+static bool report(const char *name, double rate, const char *unit,
+                   result_t *res, result_t *first) {
+  printf("%-14s %12.1f %-6s %10lu %-7s checksum %016lx\n", name, rate, unit,
+         res->count, unit[0] == 'M' ? "bytes" : "entries", res->sum);
+  return res->count == first->count && res->sum == first->sum;
+}
+
+int main(int argc, char *argv[]) {
+  const char *dirpath = "/usr/bin";
+  int repeats = 3, opt, fd;
+  uring_t plain, ring;
+  bool agree = true;
+  struct stat st;
+
+  while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+    if (opt == 'n' && (repeats = atoi(optarg)) > 0)
+      continue;
+    if (opt == 'd') {
+      dirpath = optarg;
+      continue;
+    }
+    goto usage;
+  }
+
+  if (optind == argc)
+    fd = generate();
+  else if (optind == argc - 1)
+    fd = Open(argv[optind], O_RDONLY, 0);
+  else
+    goto usage;
+  Fstat(fd, &st);
+
+  uring_init(&plain, 0);
+  if (uring_init(&ring, ENTRIES) < 0)
+    fprintf(stderr, "uringbench: io_uring not available\n");
+
+  int nnames, dirfd = Open(dirpath, O_RDONLY | O_DIRECTORY, 0);
+  char **names = listdir(dirpath, &nnames);
+  result_t first = {0, 0}, res = {0, 0};
+  double start;
+
+  start = now();
+  for (int r = 0; r < repeats; r++)
+    first = probe_ring(&plain, dirfd, names, nnames);
+  report("statx", repeats * nnames / (now() - start) / 1e3, "K/s", &first,
+         &first);
+
+  start = now();
+  for (int r = 0; r < repeats; r++)
+    res = probe_ring(&ring, dirfd, names, nnames);
+  agree &= report("statx uring", repeats * nnames / (now() - start) / 1e3,
+                  "K/s", &res, &first);
+
+  start = now();
+  for (int r = 0; r < repeats; r++)
+    first = read_rio(fd);
+  report("read rio", repeats * st.st_size / (now() - start) / 1e6, "MB/s",
+         &first, &first);
+
+  start = now();
+  for (int r = 0; r < repeats; r++)
+    res = read_ring(&ring, fd, st.st_size);
+  agree &= report("read uring", repeats * st.st_size / (now() - start) / 1e6,
+                  "MB/s", &res, &first);
+
+  for (int i = 0; i < nnames; i++)
+    free(names[i]);
+  free(names);
+  Close(dirfd);
+  Close(fd);
+  uring_free(&ring);
+  uring_free(&plain);
+
+  if (!agree) {
+    fprintf(stderr, "uringbench: results do not agree\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+
+usage:
+  fprintf(stderr, "usage: %s [-n repeats] [-d directory] [file]\n", argv[0]);
+  return EXIT_FAILURE;
+}